@@ -0,0 +1,320 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+#include <zephyr.h>
+#include <sys/printk.h>
+#include <stdio.h>
+#if defined(CONFIG_BOARD_NATIVE_POSIX)
+#include <native_rtc.h>
+#endif
+
+#include "nat_energy.h"
+#include "nat_json.h"
+
+#define ITERATIONS CONFIG_NAT_TEST_BENCH_ITERATIONS
+#define RESULTS_COUNT 4
+#define ENERGY_INTERVAL 60
+#define ENERGY_CONNECTED_MS 2000
+
+/* Modem parameters as reported by modem_info, one set per benchmark row */
+struct bench_params {
+	const char *name;
+	const char *ip_address;
+	const char *operator;
+	const char *iccid;
+	const char *imei;
+};
+
+struct bench_stats {
+	u64_t ns;
+	u32_t allocs;
+	size_t arena_peak;
+	int bytes;
+};
+
+static const struct bench_params params_sets[] = {
+	{
+		.name = "typical",
+		.ip_address = "10.160.33.79",
+		.operator = "24201",
+		.iccid = "89450421180216216095",
+		.imei = "352656100367872",
+	},
+	{
+		.name = "dual_stack",
+		.ip_address = "10.160.33.79 2001:db8:85a3:8d3:1319:8a2e:370:7348",
+		.operator = "24201",
+		.iccid = "89450421180216216095",
+		.imei = "352656100367872",
+	},
+	{
+		/* One more than nat_json accepts */
+		.name = "many_ips",
+		.ip_address = "10.0.0.1 10.0.0.2 10.0.0.3 10.0.0.4 10.0.0.5 "
+			      "10.0.0.6 10.0.0.7 10.0.0.8 10.0.0.9 10.0.0.10 "
+			      "10.0.0.11",
+		.operator = "24201",
+		.iccid = "89450421180216216095",
+		.imei = "352656100367872",
+	},
+	{
+		.name = "long_operator",
+		.ip_address = "10.160.33.79",
+		.operator = "Telenor Norge AS Long Operator Name For Benchmarks",
+		.iccid = "8945042118021621609501234",
+		.imei = "352656100367872",
+	},
+};
+
+static const char reply[] =
+	"{\"seq\":42,\"nonce\":3735928559,\"ext_ip\":\"203.0.113.17\","
+	"\"ext_port\":49152,\"recv_ts\":1594370000123,"
+	"\"send_ts\":1594370032456,\"interval\":32}";
+
+static struct modem_param_info modem_params;
+static char buf[BUF_SIZE];
+
+static u64_t now_ns(void)
+{
+#if defined(CONFIG_BOARD_NATIVE_POSIX)
+	/* Simulated time does not advance while code runs, so use the host
+	 * clock.
+	 */
+	return native_rtc_gettime_us(RTC_CLOCK_PSEUDOHOSTREALTIME) * 1000;
+#else
+	return k_cyc_to_ns_floor64(k_cycle_get_32());
+#endif
+}
+
+static void copy_value(char *dst, size_t size, const char *src)
+{
+	strncpy(dst, src, size - 1);
+	dst[size - 1] = '\0';
+}
+
+static void params_set(const struct bench_params *params)
+{
+	memset(&modem_params, 0, sizeof(modem_params));
+
+	copy_value(modem_params.network.ip_address.value_string,
+		   sizeof(modem_params.network.ip_address.value_string),
+		   params->ip_address);
+	copy_value(modem_params.network.current_operator.value_string,
+		   sizeof(modem_params.network.current_operator.value_string),
+		   params->operator);
+	copy_value(modem_params.sim.iccid.value_string,
+		   sizeof(modem_params.sim.iccid.value_string), params->iccid);
+	copy_value(modem_params.device.imei.value_string,
+		   sizeof(modem_params.device.imei.value_string), params->imei);
+	modem_params.network.cellid_dec = 30401;
+	modem_params.network.ue_mode.value = 2;
+	modem_params.network.lte_mode.value = 1;
+}
+
+static int probe_encode(int i)
+{
+	struct nat_json_probe probe = {
+		.type = TEST_UDP,
+		.interval = 32,
+		.seq = i,
+		.nonce = 0xdeadbeef,
+	};
+
+	return nat_json_probe_encode(&probe, &modem_params, buf, sizeof(buf));
+}
+
+static int reply_parse(int i)
+{
+	struct nat_json_reply parsed;
+
+	nat_json_reply_parse(reply, &parsed);
+
+	return parsed.has_id ? sizeof(reply) - 1 : -EINVAL;
+}
+
+static int results_encode(int i)
+{
+	struct nat_result results[RESULTS_COUNT];
+
+	for (int r = 0; r < ARRAY_SIZE(results); r++) {
+		memset(&results[r], 0, sizeof(results[r]));
+		results[r].id = i * RESULTS_COUNT + r;
+		results[r].timeout = 3600 + r;
+		results[r].lower = 3600;
+		results[r].upper = 3601;
+		results[r].probe_count = 24;
+		results[r].total_wait_s = 32000;
+		results[r].cell_id = modem_params.network.cellid_dec;
+		strncpy(results[r].operator,
+			modem_params.network.current_operator.value_string,
+			sizeof(results[r].operator));
+	}
+
+	return nat_json_results_encode(results, ARRAY_SIZE(results),
+				       modem_params.device.imei.value_string,
+				       buf, sizeof(buf));
+}
+
+static void bench_run(const char *bench, int (*fn)(int i),
+		      const struct bench_params *params)
+{
+	struct nat_json_arena_stats before;
+	struct nat_json_arena_stats after;
+	struct bench_stats stats = { 0 };
+	u64_t start;
+	int ret;
+
+	params_set(params);
+	nat_json_arena_peak_reset();
+	nat_json_arena_stats_get(&before);
+
+	start = now_ns();
+	for (int i = 0; i < ITERATIONS; i++) {
+		ret = fn(i);
+		if (ret < 0) {
+			printk("%s,%s,error,%d\n", bench, params->name, ret);
+			return;
+		}
+		stats.bytes = ret;
+		/* As after every probe in the firmware */
+		nat_json_arena_reset();
+	}
+	stats.ns = now_ns() - start;
+
+	nat_json_arena_stats_get(&after);
+	stats.allocs = after.alloc_count - before.alloc_count;
+	stats.arena_peak = after.peak;
+
+	printk("%s,%s,%d,%u,%u,%u,%d\n", bench, params->name, ITERATIONS,
+	       (u32_t)(stats.ns / ITERATIONS), stats.allocs / ITERATIONS,
+	       (u32_t)stats.arena_peak, stats.bytes);
+}
+
+/* The firmware's version lives in nat_test.c, which needs the modem */
+const char *nat_test_type_name(enum test_type type)
+{
+	return type == TEST_UDP ? "udp" : "tcp";
+}
+
+static void check(const char *name, int expected, int actual)
+{
+	printk("%s,%s,%d,%d\n", name, expected == actual ? "pass" : "fail",
+	       expected, actual);
+}
+
+/* Model with the configured currents, one keep-alive per day */
+/* Expected values are worked out by hand for the currents in prj.conf:
+ * 6000 uA connected, 500 uA idle, 5 uA in PSM and 60 s active time.
+ */
+static void energy_model_check(void)
+{
+	/* One keep-alive per day, 1 s connected, 60 s idle, 86339 s PSM:
+	 * (6000 + 30000 + 431695) uAs / 3600 = 129.9 uAh
+	 */
+	check("energy_model_day", 129,
+	      nat_energy_uah_per_day(24 * 3600, 1000));
+	/* 144 keep-alives, 288 s connected, 8640 s idle, 77472 s PSM:
+	 * (1728000 + 4320000 + 387360) uAs / 3600 = 1787.6 uAh
+	 */
+	check("energy_model_10_min", 1787, nat_energy_uah_per_day(600, 2000));
+	/* 2880 keep-alives, 5760 s connected, the rest of the day idle since
+	 * the active time is longer than the interval:
+	 * (34560000 + 40320000) uAs / 3600 = 20800 uAh
+	 */
+	check("energy_model_no_psm", 20800, nat_energy_uah_per_day(30, 2000));
+	/* Connected all day: 86400 s * 6000 uA / 3600 = 144000 uAh */
+	check("energy_model_always_connected", 144000,
+	      nat_energy_uah_per_day(1, 2000));
+	check("energy_model_no_interval", 0, nat_energy_uah_per_day(0, 1000));
+}
+
+/* Injects the radio events of one keep-alive, simulated time advances in
+ * k_sleep()
+ */
+static void energy_inject_connection(void)
+{
+	/* Idle before and after, uptime 0 would read as not connected */
+	k_sleep(K_MSEC(ENERGY_CONNECTED_MS));
+	nat_energy_rrc_update(true);
+	k_sleep(K_MSEC(ENERGY_CONNECTED_MS));
+	nat_energy_rrc_update(false);
+	k_sleep(K_MSEC(ENERGY_CONNECTED_MS));
+}
+
+static int energy_connected_ms(int type)
+{
+	struct nat_energy_point point;
+
+	if (nat_energy_curve_get(type, &point, 1) != 1) {
+		return -1;
+	}
+
+	return point.connected_ms;
+}
+
+static void energy_timeline_check(void)
+{
+	/* One probe is charged the whole connection */
+	nat_energy_clear();
+	nat_energy_probe_start(0, TEST_UDP, ENERGY_INTERVAL);
+	energy_inject_connection();
+	nat_energy_probe_outcome(0, true);
+	nat_energy_probe_stop(0);
+	check("energy_single_probe", ENERGY_CONNECTED_MS,
+	      energy_connected_ms(TEST_UDP));
+
+	/* Concurrent probes share it */
+	nat_energy_clear();
+	nat_energy_probe_start(0, TEST_UDP, ENERGY_INTERVAL);
+	nat_energy_probe_start(1, TEST_TCP, ENERGY_INTERVAL);
+	energy_inject_connection();
+	nat_energy_probe_outcome(0, true);
+	nat_energy_probe_outcome(1, true);
+	nat_energy_probe_stop(0);
+	nat_energy_probe_stop(1);
+	check("energy_concurrent_udp", ENERGY_CONNECTED_MS / 2,
+	      energy_connected_ms(TEST_UDP));
+	check("energy_concurrent_tcp", ENERGY_CONNECTED_MS / 2,
+	      energy_connected_ms(TEST_TCP));
+
+	/* A probe started after the connection is not charged for it */
+	nat_energy_clear();
+	nat_energy_probe_start(0, TEST_UDP, ENERGY_INTERVAL);
+	energy_inject_connection();
+	nat_energy_probe_start(1, TEST_TCP, ENERGY_INTERVAL);
+	nat_energy_probe_outcome(0, true);
+	nat_energy_probe_outcome(1, true);
+	nat_energy_probe_stop(0);
+	nat_energy_probe_stop(1);
+	check("energy_late_probe", 0, energy_connected_ms(TEST_TCP));
+
+	nat_energy_clear();
+}
+
+void main(void)
+{
+	nat_json_init();
+
+	/* Stable format, compare runs with diff or any CSV tool */
+	printk("bench,params,iterations,ns_per_call,allocs_per_call,arena_peak_bytes,bytes\n");
+
+	for (size_t i = 0; i < ARRAY_SIZE(params_sets); i++) {
+		bench_run("probe_encode", probe_encode, &params_sets[i]);
+	}
+
+	bench_run("reply_parse", reply_parse, &params_sets[0]);
+
+	for (size_t i = 0; i < ARRAY_SIZE(params_sets); i++) {
+		bench_run("results_encode", results_encode, &params_sets[i]);
+	}
+
+	/* Energy model with injected radio events */
+	printk("check,result,expected,actual\n");
+	energy_model_check();
+	energy_timeline_check();
+
+	printk("done\n");
+}
@@ -0,0 +1,175 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2020 Nordic Semiconductor ASA
+#
+# SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+#
+
+"""Per module ROM/RAM footprint report with budget check.
+
+Input sections in the linker map file are attributed to the library they
+were linked from. Objects of the application library are reported one by
+one. Image totals are taken from the size tool and compared against the
+configured budgets. A budget of 0 disables the check.
+"""
+
+import argparse
+import re
+import subprocess
+import sys
+from collections import defaultdict
+
+NON_ALLOC_PREFIXES = ('.debug', '.comment', '.ARM.attributes', '.note',
+                      '.stab', '.symtab', '.strtab', '.shstrtab')
+APP_LIBRARY = 'libapp.a'
+
+OUTPUT_RE = re.compile(r'^(\S+)\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)'
+                       r'(\s+load address\s+0x[0-9a-fA-F]+)?')
+ADDR_RE = re.compile(r'^\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)'
+                     r'(\s+load address\s+0x[0-9a-fA-F]+)?\s*$')
+INPUT_RE = re.compile(r'^ (\S+)\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)'
+                      r'\s+(\S.*)$')
+INPUT_CONT_RE = re.compile(r'^\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)'
+                           r'\s+(\S.*)$')
+
+
+def module_name(obj):
+    """Return the module an input file belongs to."""
+    match = re.match(r'^(.*?)([^/\\]+\.a)\((.+)\)$', obj)
+    if match is None:
+        return obj.split('/')[-1]
+    if match.group(2) == APP_LIBRARY:
+        return 'app/' + match.group(3).replace('.obj', '')
+    return match.group(2)
+
+
+def classify(name, address, has_load_address, ram_base):
+    """Return (rom, ram) flags for an output section."""
+    if name.startswith(NON_ALLOC_PREFIXES):
+        return (False, False)
+    if address < ram_base:
+        return (True, False)
+    return (has_load_address, True)
+
+
+def parse_map(path, ram_base):
+    modules = defaultdict(lambda: [0, 0])
+    section = (False, False)
+    pending_output = None
+    pending_input = None
+
+    with open(path, encoding='utf-8', errors='replace') as map_file:
+        lines = map_file.read().splitlines()
+
+    try:
+        start = lines.index('Linker script and memory map') + 1
+    except ValueError:
+        start = 0
+
+    for line in lines[start:]:
+        if pending_output is not None:
+            match = ADDR_RE.match(line)
+            if match:
+                section = classify(pending_output, int(match.group(1), 16),
+                                   match.group(3) is not None, ram_base)
+            pending_output = None
+            continue
+
+        if pending_input is not None:
+            match = INPUT_CONT_RE.match(line)
+            pending_input = None
+            if match:
+                size = int(match.group(2), 16)
+                entry = modules[module_name(match.group(3).strip())]
+                entry[0] += size if section[0] else 0
+                entry[1] += size if section[1] else 0
+            continue
+
+        if not line or line.startswith(' *'):
+            continue
+
+        if not line[0].isspace():
+            match = OUTPUT_RE.match(line)
+            if match:
+                section = classify(match.group(1), int(match.group(2), 16),
+                                   match.group(4) is not None, ram_base)
+            elif re.match(r'^\S+$', line):
+                pending_output = line
+            continue
+
+        match = INPUT_RE.match(line)
+        if match:
+            size = int(match.group(3), 16)
+            entry = modules[module_name(match.group(4).strip())]
+            entry[0] += size if section[0] else 0
+            entry[1] += size if section[1] else 0
+        elif re.match(r'^ \S+$', line):
+            pending_input = line.strip()
+
+    return modules
+
+
+def image_totals(size_tool, elf):
+    output = subprocess.check_output([size_tool, '-B', '-d', elf],
+                                     universal_newlines=True)
+    text, data, bss = (int(x) for x in output.splitlines()[1].split()[:3])
+    return text + data, data + bss
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('--size', required=True, help='size tool')
+    parser.add_argument('--elf', required=True, help='linked image')
+    parser.add_argument('--map', required=True, help='linker map file')
+    parser.add_argument('--output', help='report file')
+    parser.add_argument('--ram-base', type=lambda x: int(x, 0),
+                        default=0x20000000, help='start address of RAM')
+    parser.add_argument('--rom-budget', type=int, default=0,
+                        help='ROM budget in bytes, 0 to disable')
+    parser.add_argument('--ram-budget', type=int, default=0,
+                        help='RAM budget in bytes, 0 to disable')
+    args = parser.parse_args()
+
+    rom_total, ram_total = image_totals(args.size, args.elf)
+
+    report = ['{:<40} {:>10} {:>10}'.format('Module', 'ROM', 'RAM')]
+    try:
+        modules = parse_map(args.map, args.ram_base)
+    except OSError as err:
+        modules = {}
+        report.append('Map file could not be read: {}'.format(err))
+
+    for name, (rom, ram) in sorted(modules.items(),
+                                   key=lambda item: (-item[1][0],
+                                                     -item[1][1])):
+        if rom or ram:
+            report.append('{:<40} {:>10} {:>10}'.format(name, rom, ram))
+
+    report.append('{:<40} {:>10} {:>10}'.format('Total', rom_total,
+                                                ram_total))
+    for name, used, budget in (('ROM', rom_total, args.rom_budget),
+                               ('RAM', ram_total, args.ram_budget)):
+        if budget > 0:
+            report.append('{} budget: {} of {} bytes ({}%)'.format(
+                name, used, budget, (used * 100) // budget))
+
+    text = '\n'.join(report)
+    print(text)
+    if args.output:
+        with open(args.output, 'w') as output:
+            output.write(text + '\n')
+
+    failed = False
+    for name, used, budget in (('ROM', rom_total, args.rom_budget),
+                               ('RAM', ram_total, args.ram_budget)):
+        if 0 < budget < used:
+            print('error: {} footprint {} exceeds budget {} by {} bytes'
+                  .format(name, used, budget, used - budget),
+                  file=sys.stderr)
+            failed = True
+
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
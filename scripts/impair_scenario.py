@@ -0,0 +1,138 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2020 Nordic Semiconductor ASA
+#
+# SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+#
+
+"""Run NAT tests under link impairment scenarios over the control protocol.
+
+For every scenario the script loads it, starts a test and waits for the
+test_stopped event. The impairment statistics are reset when a test starts,
+so the results and the impair.stats read afterwards are printed as one CSV
+line per scenario. Requires pyserial and a firmware built with
+CONFIG_NAT_TEST_CTRL and CONFIG_NAT_TEST_IMPAIR.
+"""
+
+import argparse
+import json
+import sys
+import time
+
+import serial
+
+SCENARIOS = ('none', 'paging', 'lossy', 'outliers', 'outage', 'nbiot')
+STATS = ('probes_dropped', 'replies_dropped', 'replies_delayed',
+         'replies_duplicated', 'outages', 'wrong_decisions',
+         'forced_timeouts', 'repeated', 'extra_s')
+
+
+def crc16_kermit(data):
+    """Return the CRC of Zephyr crc16_ccitt() with seed 0."""
+    crc = 0
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = (crc >> 1) ^ 0x8408 if crc & 1 else crc >> 1
+    return crc
+
+
+def parse_frame(line):
+    """Return the JSON object of a frame line, or None for other output."""
+    start = line.find('@')
+    end = line.rfind('*')
+    if start < 0 or end < start:
+        return None
+    payload = line[start + 1:end]
+    try:
+        crc = int(line[end + 1:].strip(), 16)
+    except ValueError:
+        return None
+    if crc16_kermit(payload.encode()) != crc:
+        print('CRC mismatch: ' + line, file=sys.stderr)
+        return None
+    return json.loads(payload)
+
+
+class Device:
+    def __init__(self, port, baudrate):
+        self.serial = serial.Serial(port, baudrate, timeout=1)
+        self.next_id = 1
+
+    def frames(self, timeout):
+        """Yield frames until timeout seconds have passed."""
+        deadline = time.monotonic() + timeout
+        while time.monotonic() < deadline:
+            line = self.serial.readline().decode(errors='replace')
+            frame = parse_frame(line)
+            if frame is not None:
+                yield frame
+
+    def request(self, commands, timeout=5):
+        """Send one request and return the responses of its commands."""
+        req_id = self.next_id
+        self.next_id += 1
+        self.serial.write('ctrl {} {}\r\n'.format(
+            req_id, ' ; '.join(commands)).encode())
+        for frame in self.frames(timeout):
+            if frame.get('id') != req_id:
+                continue
+            if 'err' in frame:
+                raise RuntimeError('Request failed: {}'.format(frame['err']))
+            for rsp in frame['rsp']:
+                if not rsp['ok']:
+                    raise RuntimeError('{} failed: {}'.format(
+                        rsp['cmd'], rsp['err']))
+            return frame['rsp']
+        raise TimeoutError('No response to request {}'.format(req_id))
+
+    def wait_event(self, name, timeout, events):
+        """Wait for an event frame, collecting all events on the way."""
+        for frame in self.frames(timeout):
+            if 'evt' not in frame:
+                continue
+            events.append(frame)
+            if frame['evt'] == name:
+                return
+        raise TimeoutError('No {} event'.format(name))
+
+
+def run_scenario(dev, scenario, test, timeout):
+    events = []
+    dev.request(['set events 1',
+                 'set impair.scenario {}'.format(scenario),
+                 'start {}'.format(test)])
+    dev.wait_event('test_stopped', timeout, events)
+    stats = dev.request(['get impair.stats'])[0]['value']
+    results = [str(e['value']) for e in events if e['evt'] == 'result']
+    return results, stats
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('port', help='serial port of the device')
+    parser.add_argument('--baudrate', type=int, default=115200)
+    parser.add_argument('--test', default='udp',
+                        help='test type passed to start (default udp)')
+    parser.add_argument('--scenario', action='append', choices=SCENARIOS,
+                        help='scenario to run, repeatable (default all)')
+    parser.add_argument('--timeout', type=float, default=6 * 3600,
+                        help='seconds to wait for a test to end')
+    args = parser.parse_args()
+
+    dev = Device(args.port, args.baudrate)
+    dev.serial.write(b'shell echo off\r\nshell colors off\r\n')
+
+    print(','.join(('scenario', 'results') + STATS))
+    for scenario in args.scenario or SCENARIOS:
+        results, stats = run_scenario(dev, scenario, args.test,
+                                      args.timeout)
+        print(','.join([scenario, ' '.join(results)] +
+                       [str(stats[s]) for s in STATS]))
+        sys.stdout.flush()
+
+    dev.request(['set impair.scenario none', 'set events 0'])
+
+
+if __name__ == '__main__':
+    main()
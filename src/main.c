@@ -6,15 +6,23 @@
 
 #include <zephyr.h>
 #include <zephyr/types.h>
-#include <cJSON_os.h>
+#include <logging/log.h>
 #include <modem/lte_lc.h>
 #include <modem/modem_info.h>
-#include <power/reboot.h>
-#include <dk_buttons_and_leds.h>
 
 #include "nat_test.h"
-
-K_SEM_DEFINE(lte_connected_startup, 0, 1);
+#include "nat_energy.h"
+#include "nat_impair.h"
+#include "nat_json.h"
+#include "nat_led.h"
+#include "nat_prof.h"
+#include "nat_progress.h"
+#include "nat_recovery.h"
+#include "nat_results.h"
+
+LOG_MODULE_REGISTER(nat_main, CONFIG_NAT_TEST_LOG_LEVEL);
+
+K_SEM_DEFINE(lte_connected, 0, 1);
 volatile enum lte_lc_nw_reg_status network_status;
 volatile enum lte_lc_system_mode network_mode;
 
@@ -48,42 +56,67 @@ int get_network_status(void)
 	return network_status;
 }
 
+bool is_lte_connected(void)
+{
+	if (nat_impair_outage_active()) {
+		return false;
+	}
+
+	return network_status == LTE_LC_NW_REG_REGISTERED_HOME ||
+	       network_status == LTE_LC_NW_REG_REGISTERED_ROAMING;
+}
+
+int lte_connected_wait(k_timeout_t timeout)
+{
+	if (is_lte_connected()) {
+		return 0;
+	}
+
+	return k_sem_take(&lte_connected, timeout);
+}
+
+s64_t get_rrc_connected_time_ms(void)
+{
+	return nat_energy_connected_ms_get();
+}
+
 static void lte_handler(const struct lte_lc_evt *const evt)
 {
-	s64_t start_time_ms = 0;
-	s64_t total_time_ms = 0;
+	static bool registered_once;
 
 	switch (evt->type) {
 	case LTE_LC_EVT_NW_REG_STATUS:
 		switch (evt->nw_reg_status) {
 		case LTE_LC_NW_REG_REGISTERED_HOME:
 		case LTE_LC_NW_REG_REGISTERED_ROAMING:
-			start_time_ms = 0;
+			if (!registered_once) {
+				registered_once = true;
+				LOG_INF("LTE connected after %d ms",
+					(int)k_uptime_get());
+			}
 
-			/* Only used during startup */
-			k_sem_give(&lte_connected_startup);
+			network_status = evt->nw_reg_status;
+			nat_recovery_link_up();
+
+			/* Wake up anyone waiting for the link */
+			k_sem_give(&lte_connected);
 			break;
+		case LTE_LC_NW_REG_NOT_REGISTERED:
 		case LTE_LC_NW_REG_SEARCHING:
 		case LTE_LC_NW_REG_UNKNOWN:
-			if (network_status == LTE_LC_NW_REG_REGISTERED_HOME ||
-			    network_status ==
-				    LTE_LC_NW_REG_REGISTERED_ROAMING) {
-				start_time_ms = k_uptime_get();
-			} else if (start_time_ms > 0) {
-				total_time_ms += k_uptime_delta(&start_time_ms);
-			}
-
-			if (total_time_ms >= CONFIG_LTE_NETWORK_TIMEOUT) {
-				printk("LTE link could not be established.\n");
-				printk("Rebooting...\n");
-				sys_reboot(SYS_REBOOT_WARM);
+			/* The first attach may search for a long time, only a
+			 * link that was up needs recovery.
+			 */
+			if (registered_once) {
+				nat_recovery_link_lost(
+					NAT_RECOVERY_REASON_SEARCHING);
 			}
 			break;
 		case LTE_LC_NW_REG_REGISTRATION_DENIED:
+			nat_recovery_link_lost(NAT_RECOVERY_REASON_DENIED);
+			break;
 		case LTE_LC_NW_REG_UICC_FAIL:
-			printk("LTE link could not be established.\n");
-			printk("Rebooting...\n");
-			sys_reboot(SYS_REBOOT_WARM);
+			nat_recovery_link_lost(NAT_RECOVERY_REASON_UICC);
 			break;
 		default:
 			break;
@@ -92,69 +125,25 @@ static void lte_handler(const struct lte_lc_evt *const evt)
 		network_status = evt->nw_reg_status;
 
 		break;
+	case LTE_LC_EVT_RRC_UPDATE:
+		nat_energy_rrc_update(evt->rrc_mode ==
+				      LTE_LC_RRC_MODE_CONNECTED);
+		break;
+	case LTE_LC_EVT_PSM_UPDATE:
+		nat_energy_psm_update(evt->psm_cfg.tau,
+				      evt->psm_cfg.active_time);
+		break;
 	default:
 		break;
 	}
 }
 
-static void indicate_status_with_led(void)
-{
-	int current_led = DK_LED1;
-	int next_led = DK_LED1;
-	bool on = false;
-
-	while (true) {
-		switch (get_test_state()) {
-		case UNINITIALIZED:
-		case IDLE:
-			current_led = next_led;
-
-			dk_set_led_off(DK_LED1);
-
-			switch (next_led) {
-			case DK_LED1:
-				next_led = DK_LED2;
-				break;
-			case DK_LED2:
-				next_led = DK_LED4;
-				break;
-			case DK_LED4:
-				next_led = DK_LED3;
-				break;
-			case DK_LED3:
-			default:
-				next_led = DK_LED1;
-				break;
-			}
-
-			dk_set_led_off(current_led);
-			dk_set_led_on(next_led);
-			break;
-		case RUNNING:
-		case ABORT:
-		default:
-			dk_set_led_off(next_led);
-
-			on = !on;
-
-			if (on) {
-				dk_set_led_on(DK_LED1);
-			} else {
-				dk_set_led_off(DK_LED1);
-			}
-			break;
-		}
-
-		k_sleep(K_SECONDS(1));
-	}
-}
-
 void main(void)
 {
 	int err;
 
-	printk("NAT-test client started\n");
-	printk("Version: %s\n", CONFIG_NAT_TEST_VERSION);
+	LOG_INF("NAT-test client started");
+	LOG_INF("Version: %s", CONFIG_NAT_TEST_VERSION);
 
 	if (IS_ENABLED(CONFIG_LTE_NETWORK_MODE_NBIOT)) {
 		network_mode = LTE_LC_SYSTEM_MODE_NBIOT;
@@ -163,26 +152,40 @@ void main(void)
 	}
 	network_status = LTE_LC_NW_REG_NOT_REGISTERED;
 
-	printk("Setting up LTE connection\n");
+	nat_recovery_init();
+	nat_impair_init();
+
+	LOG_INF("Setting up LTE connection");
 
 	err = lte_lc_init_and_connect_async(lte_handler);
 	if (err) {
-		printk("Error initializing and connecting to LTE, error: %d\n",
-		       err);
+		LOG_ERR("Error initializing and connecting to LTE, error: %d",
+			err);
 		return;
 	}
 
-	k_sem_take(&lte_connected_startup, K_FOREVER);
+	/* Everything below runs while the modem attaches. The test thread
+	 * waits for registration itself and sends the first probe as soon as
+	 * the link is up.
+	 */
+	err = nat_led_init();
+	if (err) {
+		LOG_WRN("Status will not be shown on the LEDs: %d", err);
+	}
 
-	printk("LTE connected\n");
+	nat_json_init();
 
-	dk_leds_init();
+	err = nat_results_init();
+	if (err) {
+		LOG_WRN("Results will not be stored: %d", err);
+	}
 
-	cJSON_Init();
+	nat_prof_init();
+	nat_progress_init();
 
 	err = modem_info_init();
 	if (err) {
-		printk("Modem info could not be initialised: %d\n", err);
+		LOG_ERR("Modem info could not be initialised: %d", err);
 		return;
 	}
 
@@ -190,8 +193,8 @@ void main(void)
 
 	err = nat_test_start(TEST_UDP_AND_TCP);
 	if (err) {
-		printk("Test was already running.\n");
+		LOG_WRN("Test was already running.");
 	}
 
-	indicate_status_with_led();
+	/* The LEDs are driven from test events, nothing left to do here */
 }
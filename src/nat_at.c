@@ -0,0 +1,348 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+#include <zephyr.h>
+#include <logging/log.h>
+#include <string.h>
+
+#include "nat_at.h"
+
+LOG_MODULE_REGISTER(nat_at, CONFIG_NAT_TEST_LOG_LEVEL);
+
+#define AT_STATS_SIZE 16
+#define AT_LINE_SIZE 128
+#define AT_PREFIX_SIZE 2
+#define RESULT_OK "OK"
+
+enum concat_support {
+	CONCAT_UNKNOWN,
+	CONCAT_SUPPORTED,
+	CONCAT_UNSUPPORTED
+};
+
+/* All below only used with at_mutex held */
+static K_MUTEX_DEFINE(at_mutex);
+static char rsp_buf[CONFIG_NAT_TEST_AT_RESPONSE_SIZE];
+static char line_buf[AT_LINE_SIZE];
+static enum concat_support concat_support;
+static struct nat_at_stats stats[AT_STATS_SIZE];
+static size_t stats_count;
+
+static void stats_record(const char *cmd, int err, u32_t latency_ms)
+{
+	struct nat_at_stats *entry = NULL;
+
+	for (size_t i = 0; i < stats_count; i++) {
+		if (!strncmp(stats[i].cmd, cmd, sizeof(stats[i].cmd) - 1)) {
+			entry = &stats[i];
+			break;
+		}
+	}
+
+	if (entry == NULL) {
+		if (stats_count >= ARRAY_SIZE(stats)) {
+			/* Only the first commands are tracked */
+			return;
+		}
+
+		entry = &stats[stats_count++];
+		memset(entry, 0, sizeof(*entry));
+		strncpy(entry->cmd, cmd, sizeof(entry->cmd) - 1);
+	}
+
+	entry->count++;
+	if (err) {
+		entry->errors++;
+	}
+	entry->last_ms = latency_ms;
+	entry->max_ms = MAX(entry->max_ms, latency_ms);
+	entry->total_ms += latency_ms;
+}
+
+/* Sends one command line, the response is left in rsp_buf */
+static int line_write(const char *line, enum at_cmd_state *state,
+		      u32_t *latency_ms)
+{
+	s64_t start = k_uptime_get();
+	int err;
+
+	rsp_buf[0] = '\0';
+	err = at_cmd_write(line, rsp_buf, sizeof(rsp_buf), state);
+	*latency_ms = (u32_t)(k_uptime_get() - start);
+
+	stats_record(line, err, *latency_ms);
+
+	if (err) {
+		LOG_DBG("%s failed: %d", log_strdup(line), err);
+	}
+
+	return err;
+}
+
+static void response_add(struct nat_at_cmd *cmd, size_t index,
+			 const char *text, size_t len,
+			 nat_at_response_cb_t cb, void *user_data)
+{
+	size_t used;
+	size_t copy;
+
+	if (cb != NULL) {
+		for (size_t off = 0; off < len;
+		     off += CONFIG_NAT_TEST_AT_CHUNK_SIZE) {
+			cb(index, &text[off],
+			   MIN(len - off, CONFIG_NAT_TEST_AT_CHUNK_SIZE),
+			   user_data);
+		}
+	}
+
+	if (cmd->buf != NULL && cmd->size > 0) {
+		used = MIN(cmd->len, cmd->size - 1);
+		copy = MIN(len, cmd->size - 1 - used);
+		memcpy(&cmd->buf[used], text, copy);
+		cmd->buf[used + copy] = '\0';
+	}
+
+	cmd->len += len;
+}
+
+/* Name of an extended command, e.g. "+CGSN" for "AT+CGSN=1" */
+static size_t cmd_name(const char *cmd, const char **name)
+{
+	*name = &cmd[AT_PREFIX_SIZE];
+
+	return strcspn(*name, "=?;");
+}
+
+/* Only read and test commands ("AT+X?", "AT+X=?") are concatenated. They
+ * can be sent again one by one if the line fails part way, set and action
+ * commands would run twice.
+ */
+static bool cmd_concatenable(const char *cmd)
+{
+	size_t len = strlen(cmd);
+
+	return len > AT_PREFIX_SIZE &&
+	       !strncasecmp(cmd, "AT", AT_PREFIX_SIZE) &&
+	       (cmd[AT_PREFIX_SIZE] == '+' || cmd[AT_PREFIX_SIZE] == '%') &&
+	       cmd[len - 1] == '?' && strchr(cmd, ';') == NULL;
+}
+
+/* Joins the commands to "AT+A;+B;%C", returns false if that is not
+ * possible.
+ */
+static bool line_join(const struct nat_at_cmd *cmds, size_t count)
+{
+	size_t len = AT_PREFIX_SIZE;
+	size_t cmd_len;
+
+	strcpy(line_buf, "AT");
+
+	for (size_t i = 0; i < count; i++) {
+		if (!cmd_concatenable(cmds[i].cmd)) {
+			return false;
+		}
+
+		cmd_len = strlen(cmds[i].cmd) - AT_PREFIX_SIZE;
+		if (len + cmd_len + 2 > sizeof(line_buf)) {
+			return false;
+		}
+
+		if (i > 0) {
+			line_buf[len++] = ';';
+		}
+		memcpy(&line_buf[len], &cmds[i].cmd[AT_PREFIX_SIZE], cmd_len);
+		len += cmd_len;
+		line_buf[len] = '\0';
+	}
+
+	return true;
+}
+
+/* Index of the command a response line belongs to, or current if the
+ * line has no known prefix
+ */
+static size_t line_owner(const struct nat_at_cmd *cmds, size_t count,
+			 const char *line, size_t current)
+{
+	const char *name;
+	size_t name_len;
+
+	for (size_t i = 0; i < count; i++) {
+		name_len = cmd_name(cmds[i].cmd, &name);
+		if (!strncasecmp(line, name, name_len) &&
+		    line[name_len] == ':') {
+			return i;
+		}
+	}
+
+	return current;
+}
+
+/* Splits the response of a concatenated line between the commands */
+static void response_split(struct nat_at_cmd *cmds, size_t count,
+			   nat_at_response_cb_t cb, void *user_data)
+{
+	const char *line = rsp_buf;
+	size_t owner = 0;
+	size_t len;
+
+	while (*line != '\0') {
+		len = strcspn(line, "\r\n");
+		if (len > 0 && !(len == strlen(RESULT_OK) &&
+				 !strncmp(line, RESULT_OK, len))) {
+			owner = line_owner(cmds, count, line, owner);
+			response_add(&cmds[owner], owner, line, len, cb,
+				     user_data);
+			response_add(&cmds[owner], owner, "\r\n", 2, cb,
+				     user_data);
+		}
+
+		line += len;
+		line += strspn(line, "\r\n");
+	}
+}
+
+static int batch_concat(struct nat_at_cmd *cmds, size_t count,
+			nat_at_response_cb_t cb, void *user_data)
+{
+	enum at_cmd_state state;
+	u32_t latency_ms;
+	int err;
+
+	err = line_write(line_buf, &state, &latency_ms);
+	if (err) {
+		return err;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		cmds[i].state = state;
+		cmds[i].latency_ms = latency_ms;
+	}
+
+	response_split(cmds, count, cb, user_data);
+
+	return 0;
+}
+
+static int batch_sequential(struct nat_at_cmd *cmds, size_t count,
+			    nat_at_response_cb_t cb, void *user_data)
+{
+	int first_err = 0;
+
+	for (size_t i = 0; i < count; i++) {
+		cmds[i].err = line_write(cmds[i].cmd, &cmds[i].state,
+					 &cmds[i].latency_ms);
+		response_add(&cmds[i], i, rsp_buf, strlen(rsp_buf), cb,
+			     user_data);
+
+		if (cmds[i].err && !first_err) {
+			first_err = cmds[i].err;
+		}
+	}
+
+	return first_err;
+}
+
+int nat_at_batch(struct nat_at_cmd *cmds, size_t count,
+		 nat_at_response_cb_t cb, void *user_data)
+{
+	int err;
+
+	for (size_t i = 0; i < count; i++) {
+		cmds[i].err = 0;
+		cmds[i].state = AT_CMD_OK;
+		cmds[i].len = 0;
+		cmds[i].latency_ms = 0;
+		if (cmds[i].buf != NULL && cmds[i].size > 0) {
+			cmds[i].buf[0] = '\0';
+		}
+	}
+
+	k_mutex_lock(&at_mutex, K_FOREVER);
+
+	if (IS_ENABLED(CONFIG_NAT_TEST_AT_CONCAT) && count > 1 &&
+	    concat_support != CONCAT_UNSUPPORTED && line_join(cmds, count)) {
+		err = batch_concat(cmds, count, cb, user_data);
+		if (err == 0) {
+			concat_support = CONCAT_SUPPORTED;
+			goto out;
+		}
+
+		/* Nothing was passed on yet, find the failing command */
+		err = batch_sequential(cmds, count, cb, user_data);
+		if (err == 0 && concat_support == CONCAT_UNKNOWN) {
+			LOG_WRN("Modem does not accept concatenated AT commands");
+			concat_support = CONCAT_UNSUPPORTED;
+		}
+		goto out;
+	}
+
+	err = batch_sequential(cmds, count, cb, user_data);
+
+out:
+	k_mutex_unlock(&at_mutex);
+
+	return err;
+}
+
+int nat_at_param_get(const char *rsp, const char *prefix, int index,
+		     char *buf, size_t size)
+{
+	size_t prefix_len = strlen(prefix);
+	const char *p = rsp;
+	const char *end;
+	bool quoted;
+	size_t len;
+
+	while (strncmp(p, prefix, prefix_len) || p[prefix_len] != ':') {
+		p = strchr(p, '\n');
+		if (p == NULL) {
+			return -ENOENT;
+		}
+		p++;
+	}
+
+	p += prefix_len + 1;
+
+	for (int i = 0;; i++) {
+		p += strspn(p, " ");
+		quoted = *p == '"';
+		if (quoted) {
+			p++;
+			end = strchr(p, '"');
+			if (end == NULL) {
+				return -ENOENT;
+			}
+		} else {
+			end = p + strcspn(p, ",\r\n");
+		}
+
+		if (i == index) {
+			len = MIN((size_t)(end - p), size - 1);
+			memcpy(buf, p, len);
+			buf[len] = '\0';
+			return 0;
+		}
+
+		p = end + strcspn(end, ",\r\n");
+		if (*p != ',') {
+			return -ENOENT;
+		}
+		p++;
+	}
+}
+
+size_t nat_at_stats_get(struct nat_at_stats *out, size_t max)
+{
+	size_t count;
+
+	k_mutex_lock(&at_mutex, K_FOREVER);
+	count = MIN(max, stats_count);
+	memcpy(out, stats, count * sizeof(*out));
+	k_mutex_unlock(&at_mutex);
+
+	return count;
+}
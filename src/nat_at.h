@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+#ifndef NAT_AT_H_
+#define NAT_AT_H_
+
+#include <zephyr.h>
+#include <modem/at_cmd.h>
+
+/* One command of a batch */
+struct nat_at_cmd {
+	const char *cmd;
+	/* Optional copy of the response, null terminated and truncated to
+	 * size
+	 */
+	char *buf;
+	size_t size;
+	/* Results: 0 or the return value of at_cmd_write(), the final state,
+	 * the full response length and the time until the modem answered.
+	 * Commands sent on one line share the latency.
+	 */
+	int err;
+	enum at_cmd_state state;
+	size_t len;
+	u32_t latency_ms;
+};
+
+/* Latency of one command line sent to the modem */
+struct nat_at_stats {
+	char cmd[32];
+	u32_t count;
+	u32_t errors;
+	u32_t last_ms;
+	u32_t max_ms;
+	u32_t total_ms;
+};
+
+/**
+ * @brief Response callback
+ *
+ * Called with consecutive chunks of each response, in command order.
+ *
+ * @param index Index of the command in the batch
+ * @param chunk Part of the response, not null terminated
+ * @param len Length of the chunk
+ * @param user_data User data passed to nat_at_batch
+ */
+typedef void (*nat_at_response_cb_t)(size_t index, const char *chunk,
+				     size_t len, void *user_data);
+
+/**
+ * @brief Function to run a batch of AT commands
+ *
+ * With CONFIG_NAT_TEST_AT_CONCAT, a batch of only extended read and test
+ * commands is concatenated into one command line, so it takes a single
+ * modem round trip. Each response line is assigned to the command whose
+ * name it starts with. If the modem rejects the line, the commands are sent
+ * one by one. Batches with other commands are always sent one by one.
+ *
+ * Responses are limited to CONFIG_NAT_TEST_AT_RESPONSE_SIZE per command
+ * line, and are passed to the callback in chunks of
+ * CONFIG_NAT_TEST_AT_CHUNK_SIZE.
+ *
+ * @param cmds Commands, results are written back
+ * @param count Number of commands
+ * @param cb Response callback, may be NULL
+ * @param user_data User data passed to the callback
+ *
+ * @return 0 if all commands succeeded, otherwise the error of the first
+ *	   failed one.
+ */
+int nat_at_batch(struct nat_at_cmd *cmds, size_t count,
+		 nat_at_response_cb_t cb, void *user_data);
+
+/**
+ * @brief Function to get a parameter from an AT response
+ *
+ * Parameters are separated by commas, quotes and surrounding spaces are
+ * removed.
+ *
+ * @param rsp Null terminated response
+ * @param prefix Response prefix, e.g. "+COPS"
+ * @param index Index of the parameter after the prefix
+ * @param buf Output, null terminated
+ * @param size Size of buf
+ *
+ * @return 0 on success, -ENOENT if the prefix or parameter is missing.
+ */
+int nat_at_param_get(const char *rsp, const char *prefix, int index,
+		     char *buf, size_t size);
+
+/**
+ * @brief Function to get the latency of the commands sent so far
+ *
+ * @param stats Output, one entry per command line
+ * @param max Number of entries in stats
+ *
+ * @return Number of entries written.
+ */
+size_t nat_at_stats_get(struct nat_at_stats *stats, size_t max);
+
+#endif /* NAT_AT_H_ */
@@ -4,7 +4,6 @@
  * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
  */
 
-#include <modem/at_cmd.h>
 #include <modem/lte_lc.h>
 #include <net/socket.h>
 #include <shell/shell.h>
@@ -15,64 +14,190 @@
 #include <zephyr.h>
 
 #include "nat_test.h"
+#include "nat_at.h"
+#include "nat_energy.h"
+#include "nat_impair.h"
+#include "nat_json.h"
+#include "nat_led.h"
+#include "nat_prof.h"
+#include "nat_progress.h"
+#include "nat_recovery.h"
+#include "nat_results.h"
+
+#define AT_BATCH_MAX 8
+
+struct at_print {
+	const struct shell *shell;
+	const struct nat_at_cmd *cmds;
+	size_t count;
+	/* Command whose response is being printed, count if none yet */
+	size_t current;
+};
+
+static void at_response_print(size_t index, const char *chunk, size_t len,
+			      void *user_data)
+{
+	struct at_print *print = user_data;
+
+	if (print->count > 1 && index != print->current) {
+		shell_print(print->shell, "> %s", print->cmds[index].cmd);
+	}
+	print->current = index;
+
+	shell_fprintf(print->shell, SHELL_NORMAL, "%.*s", (int)len, chunk);
+}
+
+static void print_at_stats(const struct shell *shell)
+{
+	struct nat_at_stats stats[16];
+	size_t count = nat_at_stats_get(stats, ARRAY_SIZE(stats));
+
+	for (size_t i = 0; i < count; i++) {
+		shell_print(shell,
+			    "%-32s %5u sent, %3u failed, last %5u ms, avg %5u ms, max %5u ms",
+			    stats[i].cmd, stats[i].count, stats[i].errors,
+			    stats[i].last_ms, stats[i].total_ms / stats[i].count,
+			    stats[i].max_ms);
+	}
+}
 
 static void handle_at_cmd(const struct shell *shell, size_t argc, char **argv)
 {
-	int err;
-	char response[200];
-	enum at_cmd_state state;
+	struct nat_at_cmd cmds[AT_BATCH_MAX];
+	struct at_print print = {
+		.shell = shell,
+		.cmds = cmds,
+		.count = argc - 1,
+		.current = argc - 1,
+	};
 
 	if (argc <= 1) {
 		shell_print(shell, "AT command was not provided\n");
 		return;
 	}
 
-	err = at_cmd_write(argv[1], response, sizeof(response), &state);
-	if (err < 0) {
-		shell_print(shell, "Error while processing AT command: %d\n",
-			    err);
-		state = AT_CMD_ERROR;
-	}
-
-	switch (state) {
-	case AT_CMD_OK:
-		shell_print(shell, "%s\n", response);
-		shell_print(shell, "OK\n");
-		break;
-	case AT_CMD_ERROR:
-		shell_print(shell, "ERROR\n");
-		break;
-	default:
-		break;
+	if (!strcmp(argv[1], "stats")) {
+		print_at_stats(shell);
+		return;
+	}
+
+	if (print.count > ARRAY_SIZE(cmds)) {
+		shell_print(shell, "At most %d AT commands at once\n",
+			    AT_BATCH_MAX);
+		return;
+	}
+
+	for (size_t i = 0; i < print.count; i++) {
+		memset(&cmds[i], 0, sizeof(cmds[i]));
+		cmds[i].cmd = argv[i + 1];
+	}
+
+	(void)nat_at_batch(cmds, print.count, at_response_print, &print);
+
+	for (size_t i = 0; i < print.count; i++) {
+		if (print.count > 1) {
+			shell_fprintf(shell, SHELL_NORMAL, "%s: ", cmds[i].cmd);
+		}
+
+		if (cmds[i].err) {
+			shell_print(shell, "ERROR %d\n", cmds[i].err);
+		} else {
+			shell_print(shell, "OK\n");
+		}
+	}
+}
+
+SHELL_CMD_REGISTER(at, NULL,
+		   "AT commands <cmd> [<cmd> ...], 'at stats' shows latencies",
+		   handle_at_cmd);
+
+#if defined(CONFIG_NAT_TEST_PROFILER)
+static struct nat_prof_cpu_window shell_cpu_window;
+
+static void print_thread_stack(const char *name, size_t size, size_t used,
+			       void *user_data)
+{
+	const struct shell *shell = user_data;
+
+	shell_print(shell, "  %-20s %5d / %5d bytes (%d%%)",
+		    name ? name : "unknown", (int)used, (int)size,
+		    size ? (int)((used * 100) / size) : 0);
+}
+
+static void handle_prof(const struct shell *shell, size_t argc, char **argv)
+{
+	struct nat_json_arena_stats arena;
+	struct nat_prof_probe_stats probe;
+	struct nat_prof_heap_stats heap;
+	int cpu_idle = nat_prof_cpu_idle_get(&shell_cpu_window);
+
+	nat_json_arena_stats_get(&arena);
+	nat_prof_probe_stats_get(&probe);
+	nat_prof_heap_stats_get(&heap);
+
+	shell_print(shell, "Stack high-water marks:");
+	nat_prof_thread_foreach(print_thread_stack, (void *)shell);
+
+	shell_print(shell, "JSON arena (%d bytes):", (int)arena.size);
+	shell_print(shell, "  used %d, peak %d bytes", (int)arena.used,
+		    (int)arena.peak);
+	shell_print(shell, "  allocs %d, failed %d", arena.alloc_count,
+		    arena.failed_count);
+
+	shell_print(shell, "Heap (%d bytes):", (int)heap.size);
+	shell_print(shell, "  used %d, peak %d bytes", (int)heap.used,
+		    (int)heap.peak);
+	shell_print(shell, "  free %d, largest block %d bytes, fragmentation %d%%",
+		    (int)heap.free, (int)heap.largest_free,
+		    heap.fragmentation);
+
+	shell_print(shell, "Probes: %d", probe.probe_count);
+	shell_print(shell, "  allocs last probe %d, max %d", probe.last_allocs,
+		    probe.max_allocs);
+
+	if (cpu_idle < 0) {
+		shell_print(shell, "CPU idle: not available");
+	} else {
+		shell_print(shell, "CPU idle: %d%%", cpu_idle);
 	}
 }
 
-SHELL_CMD_REGISTER(at, NULL, "AT commands", handle_at_cmd);
+static void handle_prof_reset(const struct shell *shell, size_t argc,
+			      char **argv)
+{
+	nat_prof_reset();
+	shell_print(shell, "Profiler statistics reset\n");
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(prof_cmds,
+			       SHELL_CMD(reset, NULL,
+					 "Reset peak and probe statistics",
+					 handle_prof_reset),
+			       SHELL_SUBCMD_SET_END);
+SHELL_CMD_REGISTER(prof, &prof_cmds, "Show resource usage", handle_prof);
+#endif /* CONFIG_NAT_TEST_PROFILER */
 
 static void handle_set_timeout(const struct shell *shell, size_t argc,
 			       char **argv)
 {
-	u32_t value;
+	int err;
+	enum test_type type = !strcmp(argv[-2], "udp") ? TEST_UDP : TEST_TCP;
 
 	if (argc <= 1) {
 		shell_print(shell, "Timeout value was not provided\n");
 		return;
 	}
 
-	value = strtol(argv[1], NULL, 10);
-	if (value <= 0) {
+	err = nat_test_initial_timeout_set(type, strtol(argv[1], NULL, 10));
+	if (err) {
 		shell_print(shell, "Timeout value needs to be > 0\n");
+		return;
 	}
 
-	if (!strcmp(argv[-2], "udp")) {
-		udp_initial_timeout = value;
-		shell_print(shell, "UDP timeout multiplier set to: %d",
-			    udp_initial_timeout);
-	} else if (!strcmp(argv[-2], "tcp")) {
-		tcp_initial_timeout = value;
-		shell_print(shell, "TCP timeout multiplier set to: %d",
-			    tcp_initial_timeout);
-	}
+	shell_print(shell, "%s initial timeout set to: %d",
+		    type == TEST_UDP ? "UDP" : "TCP",
+		    type == TEST_UDP ? udp_initial_timeout :
+				       tcp_initial_timeout);
 }
 
 static void handle_get_timeout(const struct shell *shell, size_t argc,
@@ -90,30 +215,26 @@ static void handle_get_timeout(const struct shell *shell, size_t argc,
 static void handle_set_multiplier(const struct shell *shell, size_t argc,
 				  char **argv)
 {
-	float value;
+	int err;
 	char msg[40];
+	enum test_type type = !strcmp(argv[-2], "udp") ? TEST_UDP : TEST_TCP;
 
 	if (argc <= 1) {
 		shell_print(shell, "Multiplier value was not provided\n");
 		return;
 	}
 
-	value = strtof(argv[1], NULL);
-	if (value <= 1) {
+	err = nat_test_timeout_multiplier_set(type, strtof(argv[1], NULL));
+	if (err) {
 		shell_print(shell, "Multiplier value needs to be > 1\n");
+		return;
 	}
 
-	if (!strcmp(argv[-2], "udp")) {
-		udp_timeout_multiplier = value;
-		snprintf(msg, 40, "UDP timeout multiplier set to: %.1f\n",
-			 udp_timeout_multiplier);
-		shell_print(shell, "%s", msg);
-	} else if (!strcmp(argv[-2], "tcp")) {
-		tcp_timeout_multiplier = value;
-		snprintf(msg, 40, "TCP timeout multiplier set to: %.1f\n",
-			 tcp_timeout_multiplier);
-		shell_print(shell, "%s", msg);
-	}
+	snprintf(msg, sizeof(msg), "%s timeout multiplier set to: %.1f\n",
+		 type == TEST_UDP ? "UDP" : "TCP",
+		 type == TEST_UDP ? udp_timeout_multiplier :
+				    tcp_timeout_multiplier);
+	shell_print(shell, "%s", msg);
 }
 
 static void handle_get_multiplier(const struct shell *shell, size_t argc,
@@ -132,6 +253,93 @@ static void handle_get_multiplier(const struct shell *shell, size_t argc,
 	}
 }
 
+static void handle_set_verify_enabled(const struct shell *shell, size_t argc,
+				      char **argv)
+{
+	if (argc <= 1) {
+		shell_print(shell, "Value was not provided\n");
+		return;
+	}
+
+	keepalive_verify_enabled = strtol(argv[1], NULL, 10) != 0;
+	shell_print(shell, "Keep-alive verification %s\n",
+		    keepalive_verify_enabled ? "enabled" : "disabled");
+}
+
+static void handle_get_verify_enabled(const struct shell *shell, size_t argc,
+				      char **argv)
+{
+	shell_print(shell, "Keep-alive verification %s\n",
+		    keepalive_verify_enabled ? "enabled" : "disabled");
+}
+
+static void handle_set_verify_cycles(const struct shell *shell, size_t argc,
+				     char **argv)
+{
+	int err;
+
+	if (argc <= 1) {
+		shell_print(shell, "Cycle count was not provided\n");
+		return;
+	}
+
+	err = nat_test_verify_cycles_set(strtol(argv[1], NULL, 10));
+	if (err) {
+		shell_print(shell, "Cycle count needs to be > 0\n");
+		return;
+	}
+
+	shell_print(shell, "Keep-alive verification cycles set to: %d\n",
+		    keepalive_verify_cycles);
+}
+
+static void handle_get_verify_cycles(const struct shell *shell, size_t argc,
+				     char **argv)
+{
+	shell_print(shell, "Keep-alive verification cycles: %d\n",
+		    keepalive_verify_cycles);
+}
+
+static void handle_set_verify_fractions(const struct shell *shell, size_t argc,
+					char **argv)
+{
+	int err;
+	int fractions[KEEPALIVE_VERIFY_MAX_FRACTIONS] = { 0 };
+
+	if (argc <= 1) {
+		shell_print(shell, "Fractions were not provided\n");
+		return;
+	} else if (argc - 1 > KEEPALIVE_VERIFY_MAX_FRACTIONS) {
+		shell_print(shell, "At most %d fractions can be provided\n",
+			    KEEPALIVE_VERIFY_MAX_FRACTIONS);
+		return;
+	}
+
+	for (int i = 1; i < argc; i++) {
+		fractions[i - 1] = strtol(argv[i], NULL, 10);
+	}
+
+	err = nat_test_verify_fractions_set(fractions, argc - 1);
+	if (err) {
+		shell_print(shell, "Fractions need to be in range 1-100\n");
+		return;
+	}
+
+	shell_print(shell, "Keep-alive verification fractions set\n");
+}
+
+static void handle_get_verify_fractions(const struct shell *shell, size_t argc,
+					char **argv)
+{
+	shell_print(shell, "Keep-alive verification fractions (%%):");
+	for (int i = 0; i < KEEPALIVE_VERIFY_MAX_FRACTIONS; i++) {
+		if (keepalive_verify_fractions[i] <= 0) {
+			break;
+		}
+		shell_print(shell, "  %d", keepalive_verify_fractions[i]);
+	}
+}
+
 static void handle_start_test(const struct shell *shell, size_t argc,
 			      char **argv)
 {
@@ -144,30 +352,23 @@ static void handle_start_test(const struct shell *shell, size_t argc,
 		type = TEST_TCP;
 	} else if (!strcmp(argv[0], "udp_and_tcp")) {
 		type = TEST_UDP_AND_TCP;
+	} else if (!strcmp(argv[0], "udp_rebind")) {
+		type = TEST_UDP_REBIND;
+	} else if (!strcmp(argv[0], "tcp_keepalive")) {
+		type = TEST_TCP_KEEPALIVE;
 	} else {
 		shell_print(shell, "Invalid test type\n");
 		return;
 	}
 
-	err = lte_lc_psm_req(false);
-	if (err < 0) {
-		shell_print(
-			shell,
-			"Failed to disable Power Saving mode.\nRequest to start test denied.\n");
+	err = nat_test_start(type);
+	if (err == -EBUSY) {
+		shell_print(shell, "Another test is still active\n");
 		return;
-	}
-
-	err = lte_lc_edrx_req(false);
-	if (err < 0) {
+	} else if (err < 0) {
 		shell_print(
 			shell,
-			"Failed to disable use of eDRX.\nRequest to start test denied.\n");
-		return;
-	}
-
-	err = nat_test_start(type);
-	if (err < 0) {
-		shell_print(shell, "Another test is still active\n");
+			"Failed to disable PSM or eDRX.\nRequest to start test denied.\n");
 		return;
 	}
 }
@@ -227,6 +428,25 @@ static void handle_get_network_status(const struct shell *shell, size_t argc,
 		    get_network_status());
 }
 
+static void handle_get_recovery_log(const struct shell *shell, size_t argc,
+				    char **argv)
+{
+	struct nat_recovery_record records[8];
+	size_t count = nat_recovery_log_get(records, ARRAY_SIZE(records));
+
+	shell_print(shell, "Link recovery: %s, epoch %d",
+		    nat_recovery_tier_name(nat_recovery_tier_get()),
+		    nat_recovery_epoch_get());
+
+	for (size_t i = 0; i < count; i++) {
+		shell_print(shell, "  at %d s: %s, %d ms, highest step: %s",
+			    records[i].start_ms / MSEC_PER_SEC,
+			    nat_recovery_reason_name(records[i].reason),
+			    records[i].duration_ms,
+			    nat_recovery_tier_name(records[i].tier));
+	}
+}
+
 SHELL_STATIC_SUBCMD_SET_CREATE(network_mode_accessor_cmds,
 			       SHELL_CMD(set, NULL, "Set network mode",
 					 handle_set_network_mode),
@@ -238,6 +458,9 @@ SHELL_STATIC_SUBCMD_SET_CREATE(network_conf_cmds,
 					 "Configure network mode", NULL),
 			       SHELL_CMD(status, NULL, "Get network status",
 					 handle_get_network_status),
+			       SHELL_CMD(recovery, NULL,
+					 "Get link recovery log",
+					 handle_get_recovery_log),
 			       SHELL_SUBCMD_SET_END);
 
 SHELL_STATIC_SUBCMD_SET_CREATE(test_timeout_accessor_cmds,
@@ -260,11 +483,44 @@ SHELL_STATIC_SUBCMD_SET_CREATE(test_conf_cmds,
 					 &test_multiplier_accessor_cmds,
 					 "Configure timeout multiplier", NULL),
 			       SHELL_SUBCMD_SET_END);
+SHELL_STATIC_SUBCMD_SET_CREATE(verify_enabled_accessor_cmds,
+			       SHELL_CMD(set, NULL,
+					 "Enable (1) or disable (0) verification",
+					 handle_set_verify_enabled),
+			       SHELL_CMD(get, NULL, "Get verification state",
+					 handle_get_verify_enabled),
+			       SHELL_SUBCMD_SET_END);
+SHELL_STATIC_SUBCMD_SET_CREATE(verify_cycles_accessor_cmds,
+			       SHELL_CMD(set, NULL, "Set cycles per interval",
+					 handle_set_verify_cycles),
+			       SHELL_CMD(get, NULL, "Get cycles per interval",
+					 handle_get_verify_cycles),
+			       SHELL_SUBCMD_SET_END);
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	verify_fractions_accessor_cmds,
+	SHELL_CMD(set, NULL, "Set fractions of timeout in percent",
+		  handle_set_verify_fractions),
+	SHELL_CMD(get, NULL, "Get fractions of timeout in percent",
+		  handle_get_verify_fractions),
+	SHELL_SUBCMD_SET_END);
+SHELL_STATIC_SUBCMD_SET_CREATE(verify_conf_cmds,
+			       SHELL_CMD(enabled, &verify_enabled_accessor_cmds,
+					 "Configure verification phase", NULL),
+			       SHELL_CMD(cycles, &verify_cycles_accessor_cmds,
+					 "Configure keep-alive cycles", NULL),
+			       SHELL_CMD(fractions,
+					 &verify_fractions_accessor_cmds,
+					 "Configure keep-alive intervals",
+					 NULL),
+			       SHELL_SUBCMD_SET_END);
 SHELL_STATIC_SUBCMD_SET_CREATE(test_conf_types_cmds,
 			       SHELL_CMD(udp, &test_conf_cmds,
 					 "Configure UDP test parameters", NULL),
 			       SHELL_CMD(tcp, &test_conf_cmds,
 					 "Configure TCP test parameters", NULL),
+			       SHELL_CMD(verify, &verify_conf_cmds,
+					 "Configure keep-alive verification",
+					 NULL),
 			       SHELL_SUBCMD_SET_END);
 SHELL_STATIC_SUBCMD_SET_CREATE(conf_cmds,
 			       SHELL_CMD(test, &test_conf_types_cmds,
@@ -278,10 +534,270 @@ SHELL_CMD_REGISTER(config, &conf_cmds, "Read/Edit NAT-test client parameters",
 SHELL_CMD_REGISTER(stop_running_test, NULL, "Stop running test",
 		   handle_stop_test);
 
+static void handle_status(const struct shell *shell, size_t argc, char **argv)
+{
+	struct nat_progress_status status[CONFIG_NAT_TEST_MAX_PROBES];
+	size_t count = nat_progress_get(status, ARRAY_SIZE(status));
+	const struct nat_progress_probe *p;
+
+	shell_print(shell, "Test %s, LEDs %s",
+		    get_test_state() == RUNNING ? "running" : "not running",
+		    nat_led_pattern_name(nat_led_pattern_get()));
+
+	for (size_t i = 0; i < count; i++) {
+		p = &status[i].probe;
+
+		shell_print(shell,
+			    "%s: %d probes, %d h %02d min elapsed, timeout %d s in [%d, %d], %s",
+			    nat_test_type_name(p->type), p->probe_count,
+			    status[i].elapsed_s / 3600,
+			    (status[i].elapsed_s / 60) % 60, p->timeout,
+			    p->lower, p->upper,
+			    p->verify_phase ? "verifying" :
+			    p->binary_search ? "binary search" : "growing");
+
+		for (int c = 0; c < NAT_PROGRESS_CASE_COUNT; c++) {
+			shell_print(shell, "  %-8s %3d probes, %d h %02d min left",
+				    nat_progress_case_name(c),
+				    status[i].remaining_probes[c],
+				    status[i].remaining_s[c] / 3600,
+				    (status[i].remaining_s[c] / 60) % 60);
+		}
+
+		if (status[i].behind) {
+			shell_print(shell,
+				    "  Behind schedule, worst case at start was %d h %02d min",
+				    status[i].initial_worst_s / 3600,
+				    (status[i].initial_worst_s / 60) % 60);
+		}
+	}
+}
+
+SHELL_CMD_REGISTER(status, NULL, "Show test progress and remaining time",
+		   handle_status);
+
+static void handle_energy(const struct shell *shell, size_t argc, char **argv)
+{
+	struct nat_energy_record records[8];
+	struct nat_energy_point points[CONFIG_NAT_TEST_ENERGY_POINTS];
+	size_t count;
+
+	shell_print(shell,
+		    "Model: connected %d uA, idle %d uA, PSM %d uA, active time %d s",
+		    CONFIG_NAT_TEST_ENERGY_CONNECTED_UA,
+		    CONFIG_NAT_TEST_ENERGY_IDLE_UA, CONFIG_NAT_TEST_ENERGY_PSM_UA,
+		    CONFIG_NAT_TEST_ENERGY_ACTIVE_TIME);
+	shell_print(shell, "RRC connected: %d ms in total",
+		    (int)nat_energy_connected_ms_get());
+
+	count = nat_energy_timeline_get(records, ARRAY_SIZE(records));
+	for (size_t i = 0; i < count; i++) {
+		if (records[i].type == NAT_ENERGY_RECORD_PSM) {
+			shell_print(shell, "  at %d ms: %s TAU %d s, active %d s",
+				    records[i].timestamp_ms,
+				    nat_energy_record_name(records[i].type),
+				    records[i].tau, records[i].active_time);
+		} else {
+			shell_print(shell, "  at %d ms: %s",
+				    records[i].timestamp_ms,
+				    nat_energy_record_name(records[i].type));
+		}
+	}
+
+	for (enum test_type type = TEST_UDP; type <= TEST_TCP_KEEPALIVE;
+	     type++) {
+		count = nat_energy_curve_get(type, points, ARRAY_SIZE(points));
+		if (count == 0) {
+			continue;
+		}
+
+		shell_print(shell, "%s:", nat_test_type_name(type));
+		for (size_t i = 0; i < count; i++) {
+			shell_print(shell,
+				    "  %6d s: %d.%02d mAh/day, radio on %d ms, %d kept, %d expired",
+				    points[i].interval,
+				    points[i].uah_per_day / 1000,
+				    (points[i].uah_per_day % 1000) / 10,
+				    points[i].connected_ms, points[i].kept,
+				    points[i].expired);
+		}
+	}
+}
+
+static void handle_energy_inject_rrc(const struct shell *shell, size_t argc,
+				     char **argv)
+{
+	if (argc <= 1) {
+		shell_print(shell, "RRC mode was not provided\n");
+		return;
+	}
+
+	nat_energy_rrc_update(strtol(argv[1], NULL, 10) != 0);
+}
+
+static void handle_energy_inject_psm(const struct shell *shell, size_t argc,
+				     char **argv)
+{
+	if (argc <= 2) {
+		shell_print(shell, "TAU and active time were not provided\n");
+		return;
+	}
+
+	nat_energy_psm_update(strtol(argv[1], NULL, 10),
+			      strtol(argv[2], NULL, 10));
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(energy_inject_cmds,
+			       SHELL_CMD(rrc, NULL,
+					 "Inject RRC connected (1) or idle (0)",
+					 handle_energy_inject_rrc),
+			       SHELL_CMD(psm, NULL,
+					 "Inject granted PSM <tau> <active time>",
+					 handle_energy_inject_psm),
+			       SHELL_SUBCMD_SET_END);
+SHELL_STATIC_SUBCMD_SET_CREATE(energy_cmds,
+			       SHELL_CMD(inject, &energy_inject_cmds,
+					 "Inject radio events as if from the modem",
+					 NULL),
+			       SHELL_SUBCMD_SET_END);
+SHELL_CMD_REGISTER(energy, &energy_cmds,
+		   "Show radio timeline and energy per keep-alive interval",
+		   handle_energy);
+
+#if defined(CONFIG_NAT_TEST_IMPAIR)
+static void handle_impair(const struct shell *shell, size_t argc, char **argv)
+{
+	struct nat_impair_stats stats;
+	const char *name;
+	int value;
+
+	shell_print(shell, "Scenario: %s", nat_impair_scenario_get());
+	for (size_t i = 0; nat_impair_param_get(i, &name, &value) == 0; i++) {
+		shell_print(shell, "  %-16s %d", name, value);
+	}
+
+	nat_impair_stats_get(&stats);
+	shell_print(shell,
+		    "Dropped %u probes and %u replies, delayed %u, duplicated %u, %u outages",
+		    stats.probes_dropped, stats.replies_dropped,
+		    stats.replies_delayed, stats.replies_duplicated,
+		    stats.outages);
+	shell_print(shell,
+		    "Wrong decisions %u, forced timeouts %u, repeated intervals %u, %u s extra",
+		    stats.wrong_decisions, stats.forced_timeouts, stats.repeated,
+		    stats.extra_ms / MSEC_PER_SEC);
+}
+
+static void handle_impair_set(const struct shell *shell, size_t argc,
+			      char **argv)
+{
+	int err;
+
+	if (argc <= 2) {
+		shell_print(shell, "Impairment and value were not provided\n");
+		return;
+	}
+
+	err = nat_impair_param_set(argv[1], strtol(argv[2], NULL, 10));
+	if (err == -ENOENT) {
+		shell_print(shell, "Unknown impairment: %s\n", argv[1]);
+	} else if (err) {
+		shell_print(shell, "Value out of range\n");
+	}
+}
+
+static void handle_impair_scenario(const struct shell *shell, size_t argc,
+				   char **argv)
+{
+	const char *name;
+
+	if (argc > 1 && nat_impair_scenario_set(argv[1]) == 0) {
+		return;
+	}
+
+	shell_print(shell, "Scenarios:");
+	for (size_t i = 0; (name = nat_impair_scenario_name(i)) != NULL; i++) {
+		shell_print(shell, "  %s", name);
+	}
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(impair_cmds,
+			       SHELL_CMD(set, NULL,
+					 "Set an impairment <name> <value>",
+					 handle_impair_set),
+			       SHELL_CMD(scenario, NULL,
+					 "Load a predefined scenario <name>",
+					 handle_impair_scenario),
+			       SHELL_SUBCMD_SET_END);
+SHELL_CMD_REGISTER(impair, &impair_cmds,
+		   "Show link impairments and their impact on the last test",
+		   handle_impair);
+#endif /* CONFIG_NAT_TEST_IMPAIR */
+
+#if defined(CONFIG_NAT_TEST_RESULTS)
+static void handle_results_list(const struct shell *shell, size_t argc,
+				char **argv)
+{
+	u32_t first;
+	u32_t next;
+	u32_t pending;
+	struct nat_result result;
+
+	nat_results_range(&first, &next, &pending);
+
+	shell_print(shell, "%d results, %d pending upload", next - first,
+		    next - pending);
+
+	for (u32_t id = first; id < next; id++) {
+		if (nat_results_read(id, &result)) {
+			continue;
+		}
+
+		shell_print(shell,
+			    "%c%d type %d rat %d op %.*s cell %d: timeout %d s [%d, %d], %d probes, %d s waited, %d contaminated",
+			    id >= pending ? '*' : ' ', result.id, result.type,
+			    result.rat, NAT_RESULT_OPERATOR_SIZE,
+			    result.operator, result.cell_id, result.timeout,
+			    result.lower, result.upper, result.probe_count,
+			    result.total_wait_s, result.contaminated);
+	}
+}
+
+static void handle_results_upload(const struct shell *shell, size_t argc,
+				  char **argv)
+{
+	int err;
+
+	err = nat_test_results_upload();
+	if (err < 0) {
+		shell_print(shell, "Results can not be uploaded while a test is running\n");
+		return;
+	}
+
+	shell_print(shell, "Result upload requested\n");
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(results_cmds,
+			       SHELL_CMD(list, NULL,
+					 "List stored results, * marks pending",
+					 handle_results_list),
+			       SHELL_CMD(upload, NULL,
+					 "Upload pending results",
+					 handle_results_upload),
+			       SHELL_SUBCMD_SET_END);
+SHELL_CMD_REGISTER(results, &results_cmds, "Stored test results", NULL);
+#endif /* CONFIG_NAT_TEST_RESULTS */
+
 SHELL_STATIC_SUBCMD_SET_CREATE(
 	test_types, SHELL_CMD(udp, NULL, "Start UDP test", handle_start_test),
 	SHELL_CMD(tcp, NULL, "Start TCP test", handle_start_test),
 	SHELL_CMD(udp_and_tcp, NULL, "Start first UDP test and then TCP test",
 		  handle_start_test),
+	SHELL_CMD(udp_rebind, NULL,
+		  "Start UDP test detecting expiry from mapping changes",
+		  handle_start_test),
+	SHELL_COND_CMD(CONFIG_NAT_TEST_TCP_KEEPALIVE, tcp_keepalive, NULL,
+		       "Start TCP test keeping the connection alive with TCP keepalives",
+		       handle_start_test),
 	SHELL_SUBCMD_SET_END);
 SHELL_CMD_REGISTER(start, &test_types, "Start test", NULL);
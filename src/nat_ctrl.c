@@ -0,0 +1,698 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+#include <zephyr.h>
+#include <modem/lte_lc.h>
+#include <shell/shell.h>
+#include <shell/shell_uart.h>
+#include <sys/crc.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "nat_test.h"
+#include "nat_event.h"
+#include "nat_impair.h"
+#include "nat_progress.h"
+#include "nat_results.h"
+
+#define FRAME_SIZE 512
+#define EVENT_FRAME_SIZE 128
+/* Room for a full energy curve, which is emitted in one burst */
+#define EVENT_QUEUE_SIZE (16 + CONFIG_NAT_TEST_ENERGY_POINTS)
+#define CMD_SEPARATOR ";"
+
+/* Frame under construction. Once it overflows, all further output is
+ * dropped and the request is answered with an error instead.
+ */
+struct ctrl_frame {
+	char buf[FRAME_SIZE];
+	size_t len;
+	bool overflow;
+};
+
+struct ctrl_cmd {
+	const char *name;
+	/* Appends result fields to the frame, returns 0 or a negative errno */
+	int (*handler)(struct ctrl_frame *frame, size_t argc, char **argv);
+};
+
+struct ctrl_param {
+	const char *name;
+	int (*get)(struct ctrl_frame *frame);
+	int (*set)(size_t argc, char **argv);
+};
+
+static const char *const state_names[] = {
+	[UNINITIALIZED] = "uninitialized",
+	[IDLE] = "idle",
+	[RUNNING] = "running",
+	[ABORT] = "abort",
+};
+
+/* Both only used from the shell thread */
+static struct ctrl_frame rsp_frame;
+static bool events_enabled;
+
+K_MSGQ_DEFINE(event_queue, sizeof(struct nat_event), EVENT_QUEUE_SIZE, 4);
+static atomic_t events_dropped;
+
+static void frame_printf(struct ctrl_frame *frame, const char *fmt, ...)
+{
+	va_list args;
+	int len;
+
+	if (frame->overflow) {
+		return;
+	}
+
+	va_start(args, fmt);
+	len = vsnprintf(&frame->buf[frame->len], sizeof(frame->buf) - frame->len,
+			fmt, args);
+	va_end(args);
+
+	if (len < 0 || len >= sizeof(frame->buf) - frame->len) {
+		frame->overflow = true;
+		return;
+	}
+
+	frame->len += len;
+}
+
+/* Appends a JSON string, escaping anything that came from the host */
+static void frame_print_string(struct ctrl_frame *frame, const char *str)
+{
+	frame_printf(frame, "\"");
+
+	for (; *str != '\0'; str++) {
+		if (*str == '"' || *str == '\\') {
+			frame_printf(frame, "\\%c", *str);
+		} else if ((unsigned char)*str < ' ') {
+			frame_printf(frame, "\\u%04x", *str);
+		} else {
+			frame_printf(frame, "%c", *str);
+		}
+	}
+
+	frame_printf(frame, "\"");
+}
+
+/* Frames are single lines starting with '@' followed by JSON and the CRC of
+ * the JSON, so a host can pick them out between log and shell output.
+ */
+static void frame_send(const struct shell *shell, const char *json)
+{
+	u16_t crc = crc16_ccitt(0, (const u8_t *)json, strlen(json));
+
+	shell_fprintf(shell, SHELL_NORMAL, "@%s*%04x\n", json, crc);
+}
+
+static int parse_int(const char *str, int *value)
+{
+	char *end;
+
+	*value = strtol(str, &end, 10);
+	if (end == str || *end != '\0') {
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int parse_float(const char *str, float *value)
+{
+	char *end;
+
+	*value = strtof(str, &end);
+	if (end == str || *end != '\0') {
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int parse_test_type(const char *str, enum test_type *type)
+{
+	for (enum test_type t = TEST_UDP; t <= TEST_TCP_KEEPALIVE; t++) {
+		if (t == TEST_TCP_KEEPALIVE &&
+		    !IS_ENABLED(CONFIG_NAT_TEST_TCP_KEEPALIVE)) {
+			continue;
+		}
+
+		if (!strcmp(str, nat_test_type_name(t))) {
+			*type = t;
+			return 0;
+		}
+	}
+
+	return -EINVAL;
+}
+
+static void event_work_fn(struct k_work *work)
+{
+	const struct shell *shell = shell_backend_uart_get_ptr();
+	struct nat_event evt;
+	char json[EVENT_FRAME_SIZE];
+	int dropped;
+
+	while (k_msgq_get(&event_queue, &evt, K_NO_WAIT) == 0) {
+		snprintf(json, sizeof(json),
+			 "{\"evt\":\"%s\",\"test\":%d,\"interval\":%d,\"value\":%d,\"t\":%u}",
+			 nat_event_name(evt.type), evt.test, evt.interval,
+			 evt.value, evt.timestamp_ms);
+		frame_send(shell, json);
+	}
+
+	dropped = atomic_set(&events_dropped, 0);
+	if (dropped > 0) {
+		snprintf(json, sizeof(json), "{\"evt\":\"dropped\",\"value\":%d}",
+			 dropped);
+		frame_send(shell, json);
+	}
+}
+
+K_WORK_DEFINE(event_work, event_work_fn);
+
+/* Runs on the emitting thread, printing is left to the system workqueue so
+ * probes never wait for the UART.
+ */
+static void event_listener(const struct nat_event *evt)
+{
+	if (k_msgq_put(&event_queue, evt, K_NO_WAIT)) {
+		atomic_inc(&events_dropped);
+	}
+
+	k_work_submit(&event_work);
+}
+
+static int get_initial_timeout(struct ctrl_frame *frame, enum test_type type)
+{
+	frame_printf(frame, ",\"value\":%d",
+		     type == TEST_UDP ? udp_initial_timeout :
+					tcp_initial_timeout);
+	return 0;
+}
+
+static int get_udp_initial_timeout(struct ctrl_frame *frame)
+{
+	return get_initial_timeout(frame, TEST_UDP);
+}
+
+static int get_tcp_initial_timeout(struct ctrl_frame *frame)
+{
+	return get_initial_timeout(frame, TEST_TCP);
+}
+
+static int set_initial_timeout(enum test_type type, size_t argc, char **argv)
+{
+	int value;
+
+	if (argc != 1 || parse_int(argv[0], &value)) {
+		return -EINVAL;
+	}
+
+	return nat_test_initial_timeout_set(type, value);
+}
+
+static int set_udp_initial_timeout(size_t argc, char **argv)
+{
+	return set_initial_timeout(TEST_UDP, argc, argv);
+}
+
+static int set_tcp_initial_timeout(size_t argc, char **argv)
+{
+	return set_initial_timeout(TEST_TCP, argc, argv);
+}
+
+static int get_multiplier(struct ctrl_frame *frame, enum test_type type)
+{
+	frame_printf(frame, ",\"value\":%.2f",
+		     type == TEST_UDP ? udp_timeout_multiplier :
+					tcp_timeout_multiplier);
+	return 0;
+}
+
+static int get_udp_multiplier(struct ctrl_frame *frame)
+{
+	return get_multiplier(frame, TEST_UDP);
+}
+
+static int get_tcp_multiplier(struct ctrl_frame *frame)
+{
+	return get_multiplier(frame, TEST_TCP);
+}
+
+static int set_multiplier(enum test_type type, size_t argc, char **argv)
+{
+	float value;
+
+	if (argc != 1 || parse_float(argv[0], &value)) {
+		return -EINVAL;
+	}
+
+	return nat_test_timeout_multiplier_set(type, value);
+}
+
+static int set_udp_multiplier(size_t argc, char **argv)
+{
+	return set_multiplier(TEST_UDP, argc, argv);
+}
+
+static int set_tcp_multiplier(size_t argc, char **argv)
+{
+	return set_multiplier(TEST_TCP, argc, argv);
+}
+
+static int get_verify_enabled(struct ctrl_frame *frame)
+{
+	frame_printf(frame, ",\"value\":%d", keepalive_verify_enabled);
+	return 0;
+}
+
+static int set_verify_enabled(size_t argc, char **argv)
+{
+	int value;
+
+	if (argc != 1 || parse_int(argv[0], &value)) {
+		return -EINVAL;
+	}
+
+	keepalive_verify_enabled = value != 0;
+
+	return 0;
+}
+
+static int get_verify_cycles(struct ctrl_frame *frame)
+{
+	frame_printf(frame, ",\"value\":%d", keepalive_verify_cycles);
+	return 0;
+}
+
+static int set_verify_cycles(size_t argc, char **argv)
+{
+	int value;
+
+	if (argc != 1 || parse_int(argv[0], &value)) {
+		return -EINVAL;
+	}
+
+	return nat_test_verify_cycles_set(value);
+}
+
+static int get_verify_fractions(struct ctrl_frame *frame)
+{
+	frame_printf(frame, ",\"value\":[");
+	for (int i = 0; i < KEEPALIVE_VERIFY_MAX_FRACTIONS; i++) {
+		if (keepalive_verify_fractions[i] <= 0) {
+			break;
+		}
+		frame_printf(frame, "%s%d", i ? "," : "",
+			     keepalive_verify_fractions[i]);
+	}
+	frame_printf(frame, "]");
+
+	return 0;
+}
+
+static int set_verify_fractions(size_t argc, char **argv)
+{
+	int fractions[KEEPALIVE_VERIFY_MAX_FRACTIONS];
+
+	if (argc > ARRAY_SIZE(fractions)) {
+		return -EINVAL;
+	}
+
+	for (size_t i = 0; i < argc; i++) {
+		if (parse_int(argv[i], &fractions[i])) {
+			return -EINVAL;
+		}
+	}
+
+	return nat_test_verify_fractions_set(fractions, argc);
+}
+
+static int get_network_mode_param(struct ctrl_frame *frame)
+{
+	frame_printf(frame, ",\"value\":%d", get_network_mode());
+	return 0;
+}
+
+static int set_network_mode_param(size_t argc, char **argv)
+{
+	int value;
+	int err;
+
+	if (argc != 1 || parse_int(argv[0], &value)) {
+		return -EINVAL;
+	}
+
+	err = set_network_mode(value);
+	if (err == -INVALID_MODE) {
+		return -EINVAL;
+	} else if (err == -TEST_RUNNING) {
+		return -EBUSY;
+	}
+
+	return err;
+}
+
+static int get_network_status_param(struct ctrl_frame *frame)
+{
+	frame_printf(frame, ",\"value\":%d", get_network_status());
+	return 0;
+}
+
+static int get_events(struct ctrl_frame *frame)
+{
+	frame_printf(frame, ",\"value\":%d", events_enabled);
+	return 0;
+}
+
+static int set_events(size_t argc, char **argv)
+{
+	int value;
+	int err;
+
+	if (argc != 1 || parse_int(argv[0], &value)) {
+		return -EINVAL;
+	}
+
+	if (value == 0) {
+		nat_event_listener_remove(event_listener);
+		events_enabled = false;
+		return 0;
+	}
+
+	err = nat_event_listener_add(event_listener);
+	if (err) {
+		return err;
+	}
+
+	events_enabled = true;
+
+	return 0;
+}
+
+#if defined(CONFIG_NAT_TEST_IMPAIR)
+static int get_impair(struct ctrl_frame *frame)
+{
+	const char *name;
+	int value;
+
+	frame_printf(frame, ",\"value\":{");
+	for (size_t i = 0; nat_impair_param_get(i, &name, &value) == 0; i++) {
+		frame_printf(frame, "%s\"%s\":%d", i ? "," : "", name, value);
+	}
+	frame_printf(frame, "}");
+
+	return 0;
+}
+
+/* Pairs of impairment name and value */
+static int set_impair(size_t argc, char **argv)
+{
+	int value;
+	int err;
+
+	if (argc == 0 || argc % 2) {
+		return -EINVAL;
+	}
+
+	for (size_t i = 0; i < argc; i += 2) {
+		if (parse_int(argv[i + 1], &value)) {
+			return -EINVAL;
+		}
+
+		err = nat_impair_param_set(argv[i], value);
+		if (err) {
+			return err;
+		}
+	}
+
+	return 0;
+}
+
+static int get_impair_scenario(struct ctrl_frame *frame)
+{
+	frame_printf(frame, ",\"value\":\"%s\"", nat_impair_scenario_get());
+	return 0;
+}
+
+static int set_impair_scenario(size_t argc, char **argv)
+{
+	if (argc != 1) {
+		return -EINVAL;
+	}
+
+	return nat_impair_scenario_set(argv[0]);
+}
+
+static int get_impair_stats(struct ctrl_frame *frame)
+{
+	struct nat_impair_stats stats;
+
+	nat_impair_stats_get(&stats);
+
+	frame_printf(frame,
+		     ",\"value\":{\"probes_dropped\":%u,\"replies_dropped\":%u,"
+		     "\"replies_delayed\":%u,\"replies_duplicated\":%u,"
+		     "\"outages\":%u,\"wrong_decisions\":%u,"
+		     "\"forced_timeouts\":%u,\"repeated\":%u,\"extra_s\":%u}",
+		     stats.probes_dropped, stats.replies_dropped,
+		     stats.replies_delayed, stats.replies_duplicated,
+		     stats.outages, stats.wrong_decisions,
+		     stats.forced_timeouts, stats.repeated,
+		     stats.extra_ms / MSEC_PER_SEC);
+
+	return 0;
+}
+#endif /* CONFIG_NAT_TEST_IMPAIR */
+
+static const struct ctrl_param params[] = {
+	{ "udp.initial_timeout", get_udp_initial_timeout,
+	  set_udp_initial_timeout },
+	{ "tcp.initial_timeout", get_tcp_initial_timeout,
+	  set_tcp_initial_timeout },
+	{ "udp.timeout_multiplier", get_udp_multiplier, set_udp_multiplier },
+	{ "tcp.timeout_multiplier", get_tcp_multiplier, set_tcp_multiplier },
+	{ "verify.enabled", get_verify_enabled, set_verify_enabled },
+	{ "verify.cycles", get_verify_cycles, set_verify_cycles },
+	{ "verify.fractions", get_verify_fractions, set_verify_fractions },
+	{ "network.mode", get_network_mode_param, set_network_mode_param },
+	{ "network.status", get_network_status_param, NULL },
+	{ "events", get_events, set_events },
+#if defined(CONFIG_NAT_TEST_IMPAIR)
+	{ "impair", get_impair, set_impair },
+	{ "impair.scenario", get_impair_scenario, set_impair_scenario },
+	{ "impair.stats", get_impair_stats, NULL },
+#endif
+};
+
+static const struct ctrl_param *param_find(const char *name)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(params); i++) {
+		if (!strcmp(name, params[i].name)) {
+			return &params[i];
+		}
+	}
+
+	return NULL;
+}
+
+static int cmd_ping(struct ctrl_frame *frame, size_t argc, char **argv)
+{
+	frame_printf(frame, ",\"t\":%u", k_uptime_get_32());
+	return 0;
+}
+
+static int cmd_start(struct ctrl_frame *frame, size_t argc, char **argv)
+{
+	enum test_type type;
+
+	if (argc != 1 || parse_test_type(argv[0], &type)) {
+		return -EINVAL;
+	}
+
+	return nat_test_start(type);
+}
+
+static int cmd_stop(struct ctrl_frame *frame, size_t argc, char **argv)
+{
+	return nat_test_stop() ? -EBUSY : 0;
+}
+
+static int cmd_state(struct ctrl_frame *frame, size_t argc, char **argv)
+{
+	int state = get_test_state();
+
+	frame_printf(frame, ",\"value\":\"%s\"",
+		     state < ARRAY_SIZE(state_names) ? state_names[state] :
+						       "unknown");
+	return 0;
+}
+
+static int cmd_progress(struct ctrl_frame *frame, size_t argc, char **argv)
+{
+	struct nat_progress_status status[CONFIG_NAT_TEST_MAX_PROBES];
+	size_t count = nat_progress_get(status, ARRAY_SIZE(status));
+
+	frame_printf(frame, ",\"value\":[");
+	for (size_t i = 0; i < count; i++) {
+		frame_printf(
+			frame,
+			"%s{\"test\":\"%s\",\"probes\":%d,\"elapsed\":%u,\"timeout\":%d,\"lower\":%d,\"upper\":%d,\"behind\":%s,\"remaining\":[%u,%u,%u]}",
+			i ? "," : "", nat_test_type_name(status[i].probe.type),
+			status[i].probe.probe_count, status[i].elapsed_s,
+			status[i].probe.timeout, status[i].probe.lower,
+			status[i].probe.upper,
+			status[i].behind ? "true" : "false",
+			status[i].remaining_s[NAT_PROGRESS_CASE_BEST],
+			status[i].remaining_s[NAT_PROGRESS_CASE_EXPECTED],
+			status[i].remaining_s[NAT_PROGRESS_CASE_WORST]);
+	}
+	frame_printf(frame, "]");
+
+	return 0;
+}
+
+static int cmd_get(struct ctrl_frame *frame, size_t argc, char **argv)
+{
+	const struct ctrl_param *param;
+
+	if (argc != 1) {
+		return -EINVAL;
+	}
+
+	param = param_find(argv[0]);
+	if (param == NULL) {
+		return -ENOENT;
+	}
+
+	return param->get(frame);
+}
+
+static int cmd_set(struct ctrl_frame *frame, size_t argc, char **argv)
+{
+	const struct ctrl_param *param;
+
+	if (argc < 1) {
+		return -EINVAL;
+	}
+
+	param = param_find(argv[0]);
+	if (param == NULL) {
+		return -ENOENT;
+	}
+
+	if (param->set == NULL) {
+		return -EACCES;
+	}
+
+	return param->set(argc - 1, &argv[1]);
+}
+
+#if defined(CONFIG_NAT_TEST_RESULTS)
+static int cmd_results(struct ctrl_frame *frame, size_t argc, char **argv)
+{
+	u32_t first;
+	u32_t next;
+	u32_t pending;
+
+	nat_results_range(&first, &next, &pending);
+	frame_printf(frame, ",\"first\":%u,\"next\":%u,\"pending\":%u", first,
+		     next, pending);
+
+	return 0;
+}
+
+static int cmd_upload(struct ctrl_frame *frame, size_t argc, char **argv)
+{
+	return nat_test_results_upload() ? -EBUSY : 0;
+}
+#endif /* CONFIG_NAT_TEST_RESULTS */
+
+static const struct ctrl_cmd cmds[] = {
+	{ "ping", cmd_ping },
+	{ "start", cmd_start },
+	{ "stop", cmd_stop },
+	{ "state", cmd_state },
+	{ "progress", cmd_progress },
+	{ "get", cmd_get },
+	{ "set", cmd_set },
+#if defined(CONFIG_NAT_TEST_RESULTS)
+	{ "results", cmd_results },
+	{ "upload", cmd_upload },
+#endif
+};
+
+static void cmd_run(struct ctrl_frame *frame, size_t argc, char **argv)
+{
+	int err = -ENOENT;
+
+	frame_printf(frame, "{\"cmd\":");
+	frame_print_string(frame, argv[0]);
+
+	for (size_t i = 0; i < ARRAY_SIZE(cmds); i++) {
+		if (!strcmp(argv[0], cmds[i].name)) {
+			err = cmds[i].handler(frame, argc - 1, &argv[1]);
+			break;
+		}
+	}
+
+	if (err) {
+		frame_printf(frame, ",\"ok\":false,\"err\":%d}", err);
+	} else {
+		frame_printf(frame, ",\"ok\":true}");
+	}
+}
+
+/* ctrl <id> <cmd> [args] [; <cmd> [args]] ... */
+static void handle_ctrl(const struct shell *shell, size_t argc, char **argv)
+{
+	int id;
+	size_t start;
+	size_t count = 0;
+
+	rsp_frame.len = 0;
+	rsp_frame.overflow = false;
+
+	if (argc < 3 || parse_int(argv[1], &id)) {
+		frame_printf(&rsp_frame, "{\"id\":null,\"err\":%d}", -EINVAL);
+		frame_send(shell, rsp_frame.buf);
+		return;
+	}
+
+	frame_printf(&rsp_frame, "{\"id\":%d,\"rsp\":[", id);
+
+	start = 2;
+	for (size_t i = 2; i <= argc; i++) {
+		if (i < argc && strcmp(argv[i], CMD_SEPARATOR)) {
+			continue;
+		}
+
+		if (i > start) {
+			if (count++ > 0) {
+				frame_printf(&rsp_frame, ",");
+			}
+			cmd_run(&rsp_frame, i - start, &argv[start]);
+		}
+		start = i + 1;
+	}
+
+	frame_printf(&rsp_frame, "]}");
+
+	if (rsp_frame.overflow) {
+		rsp_frame.len = 0;
+		rsp_frame.overflow = false;
+		frame_printf(&rsp_frame, "{\"id\":%d,\"err\":%d}", id, -ENOMEM);
+	}
+
+	frame_send(shell, rsp_frame.buf);
+}
+
+SHELL_CMD_REGISTER(ctrl, NULL,
+		   "Machine-readable control: ctrl <id> <cmd> [args] [; ...]",
+		   handle_ctrl);
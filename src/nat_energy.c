@@ -0,0 +1,378 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+#include <zephyr.h>
+#include <logging/log.h>
+
+#include "nat_test.h"
+#include "nat_energy.h"
+#include "nat_event.h"
+
+LOG_MODULE_REGISTER(nat_energy, CONFIG_NAT_TEST_LOG_LEVEL);
+
+#define SECONDS_PER_DAY (24 * 60 * 60)
+#define SECONDS_PER_HOUR (60 * 60)
+
+struct energy_probe {
+	bool active;
+	bool has_outcome;
+	bool kept;
+	int type;
+	int interval;
+	/* Share of the radio time since the probe started */
+	s64_t connected_ms;
+};
+
+/* Sums of all probes at one interval */
+struct energy_sum {
+	int type;
+	int interval;
+	u16_t kept;
+	u16_t expired;
+	s64_t connected_ms;
+};
+
+static const char *const record_names[] = {
+	[NAT_ENERGY_RECORD_RRC_CONNECTED] = "rrc_connected",
+	[NAT_ENERGY_RECORD_RRC_IDLE] = "rrc_idle",
+	[NAT_ENERGY_RECORD_PSM] = "psm",
+};
+
+BUILD_ASSERT(ARRAY_SIZE(record_names) == NAT_ENERGY_RECORD_COUNT,
+	     "Record name missing");
+
+/* Shared with the LTE event handler */
+static s64_t connected_start_ms;
+static s64_t connected_total_ms;
+static struct nat_energy_record timeline[CONFIG_NAT_TEST_ENERGY_TIMELINE_SIZE];
+static size_t timeline_count;
+static size_t timeline_next;
+
+/* Only written from the test thread */
+static struct energy_probe probes[CONFIG_NAT_TEST_MAX_PROBES];
+static struct energy_sum sums[CONFIG_NAT_TEST_ENERGY_POINTS];
+static size_t sum_count;
+/* Radio time already split between the active probes */
+static s64_t split_connected_ms;
+
+const char *nat_energy_record_name(enum nat_energy_record_type type)
+{
+	if (type >= NAT_ENERGY_RECORD_COUNT) {
+		return "unknown";
+	}
+
+	return record_names[type];
+}
+
+/* Must be called with interrupts locked */
+static void timeline_add(const struct nat_energy_record *record)
+{
+	timeline[timeline_next] = *record;
+	timeline_next = (timeline_next + 1) % ARRAY_SIZE(timeline);
+	if (timeline_count < ARRAY_SIZE(timeline)) {
+		timeline_count++;
+	}
+}
+
+void nat_energy_rrc_update(bool connected)
+{
+	s64_t now = k_uptime_get();
+	struct nat_energy_record record = {
+		.type = connected ? NAT_ENERGY_RECORD_RRC_CONNECTED :
+				    NAT_ENERGY_RECORD_RRC_IDLE,
+		.timestamp_ms = (u32_t)now,
+	};
+	unsigned int key = irq_lock();
+
+	if (connected) {
+		if (connected_start_ms == 0) {
+			connected_start_ms = now;
+		}
+	} else if (connected_start_ms > 0) {
+		connected_total_ms += now - connected_start_ms;
+		connected_start_ms = 0;
+	}
+
+	timeline_add(&record);
+	irq_unlock(key);
+}
+
+void nat_energy_psm_update(int tau, int active_time)
+{
+	struct nat_energy_record record = {
+		.type = NAT_ENERGY_RECORD_PSM,
+		.timestamp_ms = k_uptime_get_32(),
+		.tau = tau,
+		.active_time = active_time,
+	};
+	unsigned int key = irq_lock();
+
+	timeline_add(&record);
+	irq_unlock(key);
+
+	LOG_INF("PSM granted: TAU %d s, active time %d s", tau, active_time);
+}
+
+s64_t nat_energy_connected_ms_get(void)
+{
+	unsigned int key = irq_lock();
+	s64_t total_ms = connected_total_ms;
+
+	if (connected_start_ms > 0) {
+		total_ms += k_uptime_get() - connected_start_ms;
+	}
+	irq_unlock(key);
+
+	return total_ms;
+}
+
+size_t nat_energy_timeline_get(struct nat_energy_record *records, size_t max)
+{
+	unsigned int key = irq_lock();
+	size_t count = MIN(max, timeline_count);
+
+	for (size_t i = 0; i < count; i++) {
+		records[i] = timeline[(timeline_next + ARRAY_SIZE(timeline) -
+				       1 - i) %
+				      ARRAY_SIZE(timeline)];
+	}
+	irq_unlock(key);
+
+	return count;
+}
+
+u32_t nat_energy_uah_per_day(int interval, u32_t connected_ms)
+{
+	double keepalives;
+	double connected_s;
+	double rest_s;
+	double idle_s;
+	double uas;
+
+	if (interval <= 0) {
+		return 0;
+	}
+
+	keepalives = (double)SECONDS_PER_DAY / interval;
+	connected_s = MIN(keepalives * connected_ms / MSEC_PER_SEC,
+			  (double)SECONDS_PER_DAY);
+	rest_s = SECONDS_PER_DAY - connected_s;
+
+	/* The modem stays in RRC idle for the active time after every
+	 * keep-alive before it may enter PSM.
+	 */
+	if (CONFIG_NAT_TEST_ENERGY_ACTIVE_TIME < 0) {
+		idle_s = rest_s;
+	} else {
+		idle_s = MIN(rest_s,
+			     keepalives * CONFIG_NAT_TEST_ENERGY_ACTIVE_TIME);
+	}
+
+	uas = connected_s * CONFIG_NAT_TEST_ENERGY_CONNECTED_UA +
+	      idle_s * CONFIG_NAT_TEST_ENERGY_IDLE_UA +
+	      (rest_s - idle_s) * CONFIG_NAT_TEST_ENERGY_PSM_UA;
+
+	return (u32_t)(uas / SECONDS_PER_HOUR);
+}
+
+void nat_energy_clear(void)
+{
+	unsigned int key = irq_lock();
+
+	memset(probes, 0, sizeof(probes));
+	sum_count = 0;
+	irq_unlock(key);
+
+	split_connected_ms = nat_energy_connected_ms_get();
+}
+
+/* Splits the radio time since the last call evenly between the probes
+ * active during it. Concurrent probes share the radio wake-ups, so each is
+ * only charged its part. Called whenever the set of active probes changes.
+ */
+static void connected_split(void)
+{
+	s64_t now_ms = nat_energy_connected_ms_get();
+	s64_t delta_ms = now_ms - split_connected_ms;
+	int active = 0;
+
+	split_connected_ms = now_ms;
+
+	for (size_t i = 0; i < ARRAY_SIZE(probes); i++) {
+		if (probes[i].active) {
+			active++;
+		}
+	}
+
+	if (active == 0) {
+		return;
+	}
+
+	for (size_t i = 0; i < ARRAY_SIZE(probes); i++) {
+		if (probes[i].active) {
+			probes[i].connected_ms += delta_ms / active;
+		}
+	}
+}
+
+static void sum_add(int type, int interval, bool kept, s64_t connected_ms)
+{
+	struct energy_sum *sum = NULL;
+	unsigned int key;
+
+	for (size_t i = 0; i < sum_count; i++) {
+		if (sums[i].type == type && sums[i].interval == interval) {
+			sum = &sums[i];
+			break;
+		}
+	}
+
+	if (sum == NULL) {
+		if (sum_count >= ARRAY_SIZE(sums)) {
+			LOG_WRN("No room for energy of %d s interval", interval);
+			return;
+		}
+
+		sum = &sums[sum_count];
+		memset(sum, 0, sizeof(*sum));
+		sum->type = type;
+		sum->interval = interval;
+
+		key = irq_lock();
+		sum_count++;
+		irq_unlock(key);
+	}
+
+	key = irq_lock();
+	if (kept) {
+		sum->kept++;
+	} else {
+		sum->expired++;
+	}
+	sum->connected_ms += connected_ms;
+	irq_unlock(key);
+}
+
+void nat_energy_probe_stop(int slot)
+{
+	struct energy_probe *probe;
+
+	if (slot < 0 || slot >= ARRAY_SIZE(probes)) {
+		return;
+	}
+
+	probe = &probes[slot];
+	if (!probe->active) {
+		return;
+	}
+
+	connected_split();
+
+	if (probe->has_outcome) {
+		sum_add(probe->type, probe->interval, probe->kept,
+			probe->connected_ms);
+	}
+
+	probe->active = false;
+}
+
+void nat_energy_probe_start(int slot, int type, int interval)
+{
+	if (slot < 0 || slot >= ARRAY_SIZE(probes)) {
+		return;
+	}
+
+	nat_energy_probe_stop(slot);
+	connected_split();
+
+	probes[slot] = (struct energy_probe){
+		.active = true,
+		.type = type,
+		.interval = interval,
+	};
+}
+
+void nat_energy_probe_outcome(int slot, bool kept)
+{
+	if (slot < 0 || slot >= ARRAY_SIZE(probes) || !probes[slot].active) {
+		return;
+	}
+
+	probes[slot].has_outcome = true;
+	probes[slot].kept = kept;
+}
+
+size_t nat_energy_curve_get(int type, struct nat_energy_point *points,
+			    size_t max)
+{
+	struct energy_sum sum;
+	struct nat_energy_point point;
+	unsigned int key;
+	size_t count = 0;
+	size_t total;
+	size_t j;
+
+	key = irq_lock();
+	total = sum_count;
+	irq_unlock(key);
+
+	for (size_t i = 0; i < total; i++) {
+		key = irq_lock();
+		sum = sums[i];
+		irq_unlock(key);
+
+		if (sum.type != type || sum.kept + sum.expired == 0) {
+			continue;
+		}
+
+		point.type = sum.type;
+		point.interval = sum.interval;
+		point.kept = sum.kept;
+		point.expired = sum.expired;
+		point.connected_ms = sum.connected_ms / (sum.kept + sum.expired);
+		point.uah_per_day =
+			nat_energy_uah_per_day(point.interval, point.connected_ms);
+
+		/* Insertion sort by interval, there are only a few points */
+		for (j = MIN(count, max); j > 0; j--) {
+			if (points[j - 1].interval <= point.interval) {
+				break;
+			}
+			if (j < max) {
+				points[j] = points[j - 1];
+			}
+		}
+		if (j < max) {
+			points[j] = point;
+		}
+		count = MIN(count + 1, max);
+	}
+
+	return count;
+}
+
+void nat_energy_report(int type)
+{
+	struct nat_energy_point points[CONFIG_NAT_TEST_ENERGY_POINTS];
+	size_t count = nat_energy_curve_get(type, points, ARRAY_SIZE(points));
+
+	if (count == 0) {
+		return;
+	}
+
+	LOG_INF("Energy per keep-alive interval, %s:",
+		nat_test_type_name(type));
+
+	for (size_t i = 0; i < count; i++) {
+		LOG_INF("%6d s: %d.%02d mAh/day, radio on %d ms, %d kept, %d expired",
+			points[i].interval, points[i].uah_per_day / 1000,
+			(points[i].uah_per_day % 1000) / 10,
+			points[i].connected_ms, points[i].kept,
+			points[i].expired);
+		nat_event_emit(NAT_EVENT_ENERGY, type, points[i].interval,
+			       points[i].uah_per_day);
+	}
+}
@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+#ifndef NAT_ENERGY_H_
+#define NAT_ENERGY_H_
+
+#include <zephyr.h>
+
+enum nat_energy_record_type {
+	NAT_ENERGY_RECORD_RRC_CONNECTED,
+	NAT_ENERGY_RECORD_RRC_IDLE,
+	/* PSM parameters granted by the network */
+	NAT_ENERGY_RECORD_PSM,
+	NAT_ENERGY_RECORD_COUNT
+};
+
+/* Radio state transition */
+struct nat_energy_record {
+	enum nat_energy_record_type type;
+	u32_t timestamp_ms;
+	/* PSM only, in seconds, -1 if not granted */
+	int tau;
+	int active_time;
+};
+
+/* Radio use of all probes at one interval */
+struct nat_energy_point {
+	/* Test type, see enum test_type */
+	int type;
+	int interval;
+	u16_t kept;
+	u16_t expired;
+	/* Time in RRC connected mode per probe, averaged */
+	u32_t connected_ms;
+	/* Modeled average charge per day if keep-alives were sent at the
+	 * interval
+	 */
+	u32_t uah_per_day;
+};
+
+/**
+ * @brief Function to record an RRC mode change
+ *
+ * Called by the LTE event handler, or from the shell to inject events.
+ *
+ * @param connected true if the modem entered RRC connected mode
+ */
+void nat_energy_rrc_update(bool connected);
+
+/**
+ * @brief Function to record PSM parameters granted by the network
+ *
+ * @param tau Periodic TAU in seconds
+ * @param active_time Active time in seconds, -1 if PSM is not used
+ */
+void nat_energy_psm_update(int tau, int active_time);
+
+/**
+ * @brief Function to get the total time spent in RRC connected mode
+ */
+s64_t nat_energy_connected_ms_get(void);
+
+/**
+ * @brief Function to get the most recent radio state transitions
+ *
+ * @param records Output, newest first
+ * @param max Number of entries in records
+ *
+ * @return Number of records written.
+ */
+size_t nat_energy_timeline_get(struct nat_energy_record *records, size_t max);
+
+/**
+ * @brief Function to get the name of a record type
+ */
+const char *nat_energy_record_name(enum nat_energy_record_type type);
+
+/**
+ * @brief Function to forget all probes, called at test start
+ */
+void nat_energy_clear(void);
+
+/**
+ * @brief Function to mark the start of the measurement of an interval
+ *
+ * The radio use of a probe is counted until the next measurement of the
+ * same probe starts, so it includes the connection kept up after the reply.
+ * While several probes run, the radio time is split evenly between them.
+ *
+ * @param slot Probe slot, less than CONFIG_NAT_TEST_MAX_PROBES
+ * @param type Test type
+ * @param interval Interval in seconds
+ */
+void nat_energy_probe_start(int slot, int type, int interval);
+
+/**
+ * @brief Function to record whether the interval was kept
+ *
+ * @param slot Probe slot
+ * @param kept true if the mapping survived the interval
+ */
+void nat_energy_probe_outcome(int slot, bool kept);
+
+/**
+ * @brief Function to mark the end of a probe
+ *
+ * @param slot Probe slot
+ */
+void nat_energy_probe_stop(int slot);
+
+/**
+ * @brief Function to get the energy curve of a test
+ *
+ * @param type Test type
+ * @param points Output, sorted by interval
+ * @param max Number of entries in points
+ *
+ * @return Number of points written.
+ */
+size_t nat_energy_curve_get(int type, struct nat_energy_point *points,
+			    size_t max);
+
+/**
+ * @brief Function to model the charge per day of periodic keep-alives
+ *
+ * Each keep-alive keeps the radio connected for connected_ms. The rest of
+ * the interval is spent in RRC idle, and in PSM after
+ * CONFIG_NAT_TEST_ENERGY_ACTIVE_TIME seconds.
+ *
+ * @param interval Keep-alive interval in seconds
+ * @param connected_ms Time in RRC connected mode per keep-alive
+ *
+ * @return Average charge per day in microampere-hours.
+ */
+u32_t nat_energy_uah_per_day(int interval, u32_t connected_ms);
+
+/**
+ * @brief Function to log the energy curve of a test
+ *
+ * @param type Test type
+ */
+void nat_energy_report(int type);
+
+#endif /* NAT_ENERGY_H_ */
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+#include <zephyr.h>
+#include <logging/log.h>
+
+#include "nat_event.h"
+
+LOG_MODULE_REGISTER(nat_event, CONFIG_NAT_TEST_LOG_LEVEL);
+
+/* Status LEDs and the control protocol */
+#define EVENT_LISTENERS_MAX 2
+
+static const char *const event_names[] = {
+	[NAT_EVENT_TEST_STARTED] = "test_started",
+	[NAT_EVENT_TEST_STOPPED] = "test_stopped",
+	[NAT_EVENT_PROBE_SENT] = "probe_sent",
+	[NAT_EVENT_PROBE_REPLY] = "probe_reply",
+	[NAT_EVENT_PROBE_TIMEOUT] = "probe_timeout",
+	[NAT_EVENT_PROBE_ERROR] = "probe_error",
+	[NAT_EVENT_PROBE_WAITING] = "probe_waiting",
+	[NAT_EVENT_PROBE_DISCARDED] = "probe_discarded",
+	[NAT_EVENT_MAPPING_CHANGED] = "mapping_changed",
+	[NAT_EVENT_PROBE_CONTAMINATED] = "probe_contaminated",
+	[NAT_EVENT_LINK_LOST] = "link_lost",
+	[NAT_EVENT_LINK_RECOVERED] = "link_recovered",
+	[NAT_EVENT_RESULT] = "result",
+	[NAT_EVENT_VERIFY_RESULT] = "verify_result",
+	[NAT_EVENT_ENERGY] = "energy",
+};
+
+BUILD_ASSERT(ARRAY_SIZE(event_names) == NAT_EVENT_COUNT,
+	     "Event name missing");
+
+/* Entries are only changed with interrupts locked */
+static nat_event_listener_t event_listeners[EVENT_LISTENERS_MAX];
+
+const char *nat_event_name(enum nat_event_type type)
+{
+	if (type >= NAT_EVENT_COUNT) {
+		return "unknown";
+	}
+
+	return event_names[type];
+}
+
+void nat_event_emit(enum nat_event_type type, int test, int interval,
+		    int value)
+{
+	struct nat_event evt = {
+		.type = type,
+		.test = test,
+		.interval = interval,
+		.value = value,
+		.timestamp_ms = k_uptime_get_32(),
+	};
+
+	/* Event names are constant strings, so the deferred log only stores
+	 * pointers and integers here and formats in the log thread.
+	 */
+	LOG_INF("%s test=%d interval=%d value=%d t=%u",
+		nat_event_name(evt.type), evt.test, evt.interval, evt.value,
+		evt.timestamp_ms);
+
+	for (size_t i = 0; i < ARRAY_SIZE(event_listeners); i++) {
+		nat_event_listener_t listener = event_listeners[i];
+
+		if (listener != NULL) {
+			listener(&evt);
+		}
+	}
+}
+
+int nat_event_listener_add(nat_event_listener_t listener)
+{
+	unsigned int key = irq_lock();
+	int err = -ENOMEM;
+
+	for (size_t i = 0; i < ARRAY_SIZE(event_listeners); i++) {
+		if (event_listeners[i] == listener) {
+			err = 0;
+			break;
+		}
+		if (event_listeners[i] == NULL && err) {
+			event_listeners[i] = listener;
+			err = 0;
+		}
+	}
+	irq_unlock(key);
+
+	return err;
+}
+
+void nat_event_listener_remove(nat_event_listener_t listener)
+{
+	unsigned int key = irq_lock();
+
+	for (size_t i = 0; i < ARRAY_SIZE(event_listeners); i++) {
+		if (event_listeners[i] == listener) {
+			event_listeners[i] = NULL;
+		}
+	}
+	irq_unlock(key);
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+#ifndef NAT_EVENT_H_
+#define NAT_EVENT_H_
+
+#include <zephyr.h>
+
+enum nat_event_type {
+	NAT_EVENT_TEST_STARTED,
+	NAT_EVENT_TEST_STOPPED,
+	NAT_EVENT_PROBE_SENT,
+	NAT_EVENT_PROBE_REPLY,
+	NAT_EVENT_PROBE_TIMEOUT,
+	NAT_EVENT_PROBE_ERROR,
+	NAT_EVENT_PROBE_WAITING,
+	NAT_EVENT_PROBE_DISCARDED,
+	NAT_EVENT_MAPPING_CHANGED,
+	NAT_EVENT_PROBE_CONTAMINATED,
+	NAT_EVENT_LINK_LOST,
+	NAT_EVENT_LINK_RECOVERED,
+	NAT_EVENT_RESULT,
+	NAT_EVENT_VERIFY_RESULT,
+	NAT_EVENT_ENERGY,
+	NAT_EVENT_COUNT
+};
+
+/**
+ * @brief Structured test event
+ *
+ * Events only carry integers, so they can be recorded without formatting
+ * anything on the test thread.
+ */
+struct nat_event {
+	enum nat_event_type type;
+	/* Test type, see enum test_type, or -1 if not test related */
+	int test;
+	/* Probe interval in seconds */
+	int interval;
+	/* Event specific value, e.g. bytes sent, elapsed or resulting time */
+	int value;
+	/* Uptime in milliseconds when the event occurred */
+	u32_t timestamp_ms;
+};
+
+/**
+ * @brief Event listener
+ *
+ * Called in the context of the emitting thread, so it must not block.
+ */
+typedef void (*nat_event_listener_t)(const struct nat_event *evt);
+
+/**
+ * @brief Function to get the name of an event type
+ */
+const char *nat_event_name(enum nat_event_type type);
+
+/**
+ * @brief Function to record a test event
+ *
+ * @param type Event type
+ * @param test Test type
+ * @param interval Probe interval in seconds
+ * @param value Event specific value
+ */
+void nat_event_emit(enum nat_event_type type, int test, int interval,
+		    int value);
+
+/**
+ * @brief Function to add an event listener
+ *
+ * @param listener Listener called for every event
+ *
+ * @return 0 on success or if already added, -ENOMEM if all listener slots
+ *	   are taken.
+ */
+int nat_event_listener_add(nat_event_listener_t listener);
+
+/**
+ * @brief Function to remove an event listener
+ *
+ * @param listener Listener to remove
+ */
+void nat_event_listener_remove(nat_event_listener_t listener);
+
+#endif /* NAT_EVENT_H_ */
@@ -0,0 +1,515 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+#include <zephyr.h>
+#include <logging/log.h>
+#include <random/rand32.h>
+#include <limits.h>
+#include <stddef.h>
+
+#include "nat_test.h"
+#include "nat_impair.h"
+#include "nat_recovery.h"
+
+LOG_MODULE_REGISTER(nat_impair, CONFIG_NAT_TEST_LOG_LEVEL);
+
+#define PERCENT_MAX 100
+#define DELAY_MAX_MS (10 * 60 * MSEC_PER_SEC)
+
+struct impair_param {
+	const char *name;
+	size_t offset;
+	int max;
+};
+
+struct impair_scenario {
+	const char *name;
+	struct nat_impair_config config;
+};
+
+/* Only used from the test thread */
+struct impair_slot {
+	bool held;
+	struct nat_impair_held reply;
+	s64_t release_ms;
+	bool probe_lost;
+	bool reply_lost;
+	s64_t lost_ms;
+	u32_t outages;
+};
+
+#define PARAM(field, limit)                                                    \
+	{                                                                      \
+		.name = #field,                                                \
+		.offset = offsetof(struct nat_impair_config, field),           \
+		.max = limit,                                                  \
+	}
+
+static const struct impair_param params[] = {
+	PARAM(loss_up, PERCENT_MAX),
+	PARAM(loss_down, PERCENT_MAX),
+	PARAM(delay_ms, DELAY_MAX_MS),
+	PARAM(jitter_ms, DELAY_MAX_MS),
+	PARAM(outlier, PERCENT_MAX),
+	PARAM(outlier_ms, DELAY_MAX_MS),
+	PARAM(duplicate, PERCENT_MAX),
+	PARAM(outage_start_s, INT_MAX),
+	PARAM(outage_s, INT_MAX),
+	PARAM(outage_period_s, INT_MAX),
+};
+
+/* Outages stay below CONFIG_NAT_TEST_RECOVERY_WAIT by default, so link
+ * recovery only waits. Longer ones also run the real recovery steps.
+ */
+static const struct impair_scenario scenarios[] = {
+	{ .name = "none" },
+	{
+		/* Downlink waits for the next paging occasion, up to the
+		 * longest NB-IoT idle mode DRX cycle.
+		 */
+		.name = "paging",
+		.config = { .delay_ms = 1280, .jitter_ms = 8960 },
+	},
+	{
+		.name = "lossy",
+		.config = { .loss_up = 5, .loss_down = 5, .duplicate = 2 },
+	},
+	{
+		/* Rare round trips longer than the reply tolerance */
+		.name = "outliers",
+		.config = { .delay_ms = 300,
+			    .jitter_ms = 700,
+			    .outlier = 5,
+			    .outlier_ms = 12000 },
+	},
+	{
+		.name = "outage",
+		.config = { .outage_start_s = 900,
+			    .outage_s = 45,
+			    .outage_period_s = 3600 },
+	},
+	{
+		.name = "nbiot",
+		.config = { .loss_up = 2,
+			    .loss_down = 2,
+			    .delay_ms = 1280,
+			    .jitter_ms = 8960,
+			    .outlier = 2,
+			    .outlier_ms = 12000,
+			    .duplicate = 1,
+			    .outage_start_s = 900,
+			    .outage_s = 45,
+			    .outage_period_s = 7200 },
+	},
+};
+
+/* Shared with the shell and the outage work */
+static struct nat_impair_config config;
+static const char *scenario_name = "none";
+static struct nat_impair_stats stats;
+static atomic_t outage;
+
+/* Copy of config taken at test start, outages are timed with it */
+static struct nat_impair_config outage_config;
+static struct k_delayed_work outage_work;
+
+static struct impair_slot slots[CONFIG_NAT_TEST_MAX_PROBES];
+
+static bool chance(int percent)
+{
+	return percent > 0 && (sys_rand32_get() % PERCENT_MAX) < percent;
+}
+
+static void config_copy(struct nat_impair_config *dst)
+{
+	unsigned int key = irq_lock();
+
+	*dst = config;
+	irq_unlock(key);
+}
+
+static void stats_add(u32_t *counter, u32_t value)
+{
+	unsigned int key = irq_lock();
+
+	*counter += value;
+	irq_unlock(key);
+}
+
+static int *param_ptr(struct nat_impair_config *cfg,
+		      const struct impair_param *param)
+{
+	return (int *)((u8_t *)cfg + param->offset);
+}
+
+static int config_check(const struct nat_impair_config *cfg)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(params); i++) {
+		int value = *param_ptr((struct nat_impair_config *)cfg,
+				       &params[i]);
+
+		if (value < 0 || value > params[i].max) {
+			return -EINVAL;
+		}
+	}
+
+	if (cfg->outage_period_s > 0 && cfg->outage_period_s <= cfg->outage_s) {
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+int nat_impair_config_set(const struct nat_impair_config *cfg)
+{
+	unsigned int key;
+
+	if (config_check(cfg)) {
+		return -EINVAL;
+	}
+
+	key = irq_lock();
+	config = *cfg;
+	scenario_name = "custom";
+	irq_unlock(key);
+
+	return 0;
+}
+
+void nat_impair_config_get(struct nat_impair_config *cfg)
+{
+	config_copy(cfg);
+}
+
+int nat_impair_param_set(const char *name, int value)
+{
+	struct nat_impair_config cfg;
+
+	for (size_t i = 0; i < ARRAY_SIZE(params); i++) {
+		if (strcmp(name, params[i].name)) {
+			continue;
+		}
+
+		config_copy(&cfg);
+		*param_ptr(&cfg, &params[i]) = value;
+
+		return nat_impair_config_set(&cfg);
+	}
+
+	return -ENOENT;
+}
+
+int nat_impair_param_get(size_t index, const char **name, int *value)
+{
+	struct nat_impair_config cfg;
+
+	if (index >= ARRAY_SIZE(params)) {
+		return -ENOENT;
+	}
+
+	config_copy(&cfg);
+	*name = params[index].name;
+	*value = *param_ptr(&cfg, &params[index]);
+
+	return 0;
+}
+
+int nat_impair_scenario_set(const char *name)
+{
+	unsigned int key;
+
+	for (size_t i = 0; i < ARRAY_SIZE(scenarios); i++) {
+		if (strcmp(name, scenarios[i].name)) {
+			continue;
+		}
+
+		key = irq_lock();
+		config = scenarios[i].config;
+		scenario_name = scenarios[i].name;
+		irq_unlock(key);
+
+		return 0;
+	}
+
+	return -ENOENT;
+}
+
+const char *nat_impair_scenario_get(void)
+{
+	return scenario_name;
+}
+
+const char *nat_impair_scenario_name(size_t index)
+{
+	if (index >= ARRAY_SIZE(scenarios)) {
+		return NULL;
+	}
+
+	return scenarios[index].name;
+}
+
+void nat_impair_stats_get(struct nat_impair_stats *out)
+{
+	unsigned int key = irq_lock();
+
+	*out = stats;
+	irq_unlock(key);
+}
+
+bool nat_impair_outage_active(void)
+{
+	return atomic_get(&outage);
+}
+
+static void outage_end(void)
+{
+	if (!atomic_set(&outage, false)) {
+		return;
+	}
+
+	LOG_WRN("Emulated outage ended");
+
+	/* Only if the real link survived the outage */
+	if (is_lte_connected()) {
+		nat_recovery_link_up();
+	}
+}
+
+static void outage_work_fn(struct k_work *work)
+{
+	if (atomic_get(&outage)) {
+		outage_end();
+
+		if (outage_config.outage_period_s > 0) {
+			k_delayed_work_submit(
+				&outage_work,
+				K_SECONDS(outage_config.outage_period_s -
+					  outage_config.outage_s));
+		}
+		return;
+	}
+
+	atomic_set(&outage, true);
+	stats_add(&stats.outages, 1);
+
+	LOG_WRN("Emulated outage for %d s", outage_config.outage_s);
+	nat_recovery_link_lost(NAT_RECOVERY_REASON_SEARCHING);
+
+	k_delayed_work_submit(&outage_work,
+			      K_SECONDS(outage_config.outage_s));
+}
+
+void nat_impair_test_start(void)
+{
+	unsigned int key;
+
+	k_delayed_work_cancel(&outage_work);
+	outage_end();
+
+	memset(slots, 0, sizeof(slots));
+	config_copy(&outage_config);
+
+	key = irq_lock();
+	memset(&stats, 0, sizeof(stats));
+	irq_unlock(key);
+
+	if (outage_config.outage_s > 0) {
+		k_delayed_work_submit(&outage_work,
+				      K_SECONDS(outage_config.outage_start_s));
+	}
+
+	if (strcmp(scenario_name, "none")) {
+		LOG_WRN("Link impairments active, scenario: %s",
+			log_strdup(scenario_name));
+	}
+}
+
+void nat_impair_test_end(void)
+{
+	struct nat_impair_stats s;
+
+	k_delayed_work_cancel(&outage_work);
+	outage_end();
+
+	nat_impair_stats_get(&s);
+
+	if (!strcmp(scenario_name, "none")) {
+		return;
+	}
+
+	LOG_INF("Impairments (%s): %u probes and %u replies dropped, %u delayed, %u duplicated, %u outages",
+		log_strdup(scenario_name), s.probes_dropped, s.replies_dropped,
+		s.replies_delayed, s.replies_duplicated, s.outages);
+	LOG_INF("Impact: %u wrong decisions, %u forced timeouts, %u intervals repeated, %u s extra",
+		s.wrong_decisions, s.forced_timeouts, s.repeated,
+		s.extra_ms / MSEC_PER_SEC);
+}
+
+bool nat_impair_probe_send(int slot)
+{
+	struct impair_slot *is;
+	struct nat_impair_config cfg;
+	unsigned int key;
+
+	if (slot < 0 || slot >= ARRAY_SIZE(slots)) {
+		return false;
+	}
+
+	is = &slots[slot];
+	config_copy(&cfg);
+
+	memset(is, 0, sizeof(*is));
+
+	key = irq_lock();
+	is->outages = stats.outages;
+	irq_unlock(key);
+
+	is->probe_lost = nat_impair_outage_active() || chance(cfg.loss_up);
+
+	if (is->probe_lost) {
+		stats_add(&stats.probes_dropped, 1);
+		LOG_DBG("Probe dropped");
+	}
+
+	return is->probe_lost;
+}
+
+static void reply_lost(struct impair_slot *is, s64_t recv_ms)
+{
+	is->reply_lost = true;
+	is->lost_ms = recv_ms;
+	stats_add(&stats.replies_dropped, 1);
+	LOG_DBG("Reply dropped");
+}
+
+enum nat_impair_action nat_impair_reply(int slot,
+					const struct nat_json_reply *reply,
+					int len, s64_t recv_ms,
+					s64_t deadline_ms)
+{
+	struct impair_slot *is;
+	struct nat_impair_config cfg;
+	s64_t delay_ms;
+
+	if (slot < 0 || slot >= ARRAY_SIZE(slots)) {
+		return NAT_IMPAIR_PASS;
+	}
+
+	is = &slots[slot];
+	config_copy(&cfg);
+
+	if (is->held) {
+		/* A copy from the network, keep the one already held */
+		return NAT_IMPAIR_DISCARD;
+	}
+
+	if (nat_impair_outage_active() || chance(cfg.loss_down)) {
+		reply_lost(is, recv_ms);
+		return NAT_IMPAIR_DROP;
+	}
+
+	delay_ms = cfg.delay_ms;
+	if (cfg.jitter_ms > 0) {
+		delay_ms += sys_rand32_get() % (cfg.jitter_ms + 1);
+	}
+	if (chance(cfg.outlier)) {
+		delay_ms += cfg.outlier_ms;
+	}
+
+	if (delay_ms > 0) {
+		if (recv_ms + delay_ms >= deadline_ms) {
+			/* Too late, the probe has timed out by then */
+			reply_lost(is, recv_ms);
+			return NAT_IMPAIR_DROP;
+		}
+
+		is->held = true;
+		is->reply.reply = *reply;
+		is->reply.len = len;
+		is->release_ms = recv_ms + delay_ms;
+		stats_add(&stats.replies_delayed, 1);
+		stats_add(&stats.extra_ms, delay_ms);
+		return NAT_IMPAIR_HOLD;
+	}
+
+	if (chance(cfg.duplicate)) {
+		stats_add(&stats.replies_duplicated, 1);
+		return NAT_IMPAIR_DUPLICATE;
+	}
+
+	return NAT_IMPAIR_PASS;
+}
+
+s64_t nat_impair_release_ms(int slot)
+{
+	if (slot < 0 || slot >= ARRAY_SIZE(slots) || !slots[slot].held) {
+		return INT64_MAX;
+	}
+
+	return slots[slot].release_ms;
+}
+
+bool nat_impair_release(int slot, s64_t now, struct nat_impair_held *held)
+{
+	struct impair_slot *is;
+
+	if (slot < 0 || slot >= ARRAY_SIZE(slots)) {
+		return false;
+	}
+
+	is = &slots[slot];
+	if (!is->held || now < is->release_ms) {
+		return false;
+	}
+
+	is->held = false;
+	*held = is->reply;
+
+	return true;
+}
+
+void nat_impair_probe_outcome(int slot, int result, bool contaminated,
+			      s64_t wait_ms)
+{
+	struct impair_slot *is;
+	u32_t outages;
+	unsigned int key;
+
+	if (slot < 0 || slot >= ARRAY_SIZE(slots)) {
+		return;
+	}
+
+	is = &slots[slot];
+
+	key = irq_lock();
+	outages = stats.outages;
+	irq_unlock(key);
+
+	if (contaminated) {
+		if (outages != is->outages) {
+			stats_add(&stats.repeated, 1);
+			stats_add(&stats.extra_ms, wait_ms);
+		}
+		return;
+	}
+
+	if (result != 0) {
+		return;
+	}
+
+	if (is->reply_lost) {
+		LOG_WRN("Interval recorded as expired although the reply arrived");
+		stats_add(&stats.wrong_decisions, 1);
+		stats_add(&stats.extra_ms, k_uptime_get() - is->lost_ms);
+	} else if (is->probe_lost) {
+		stats_add(&stats.forced_timeouts, 1);
+	}
+}
+
+void nat_impair_init(void)
+{
+	k_delayed_work_init(&outage_work, outage_work_fn);
+}
@@ -0,0 +1,270 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+#ifndef NAT_IMPAIR_H_
+#define NAT_IMPAIR_H_
+
+#include <zephyr.h>
+
+#include "nat_json.h"
+
+/* What happens to a reply to the probe in flight */
+enum nat_impair_action {
+	NAT_IMPAIR_PASS,
+	NAT_IMPAIR_DROP,
+	/* Held back, delivered by nat_impair_release */
+	NAT_IMPAIR_HOLD,
+	/* Delivered now and a second time right after */
+	NAT_IMPAIR_DUPLICATE,
+	/* Another copy of the reply already held, discard it as a duplicate */
+	NAT_IMPAIR_DISCARD
+};
+
+/* Percentages are per packet. All values 0 disable the emulator. */
+struct nat_impair_config {
+	/* Probes dropped before they are sent */
+	int loss_up;
+	/* Replies dropped on reception */
+	int loss_down;
+	/* Added to every reply, plus a uniformly distributed jitter */
+	int delay_ms;
+	int jitter_ms;
+	/* Replies delayed by outlier_ms on top of the delay */
+	int outlier;
+	int outlier_ms;
+	int duplicate;
+	/* Registration outage outage_start_s after the test started, lasting
+	 * outage_s and repeated every outage_period_s, 0 for only one.
+	 */
+	int outage_start_s;
+	int outage_s;
+	int outage_period_s;
+};
+
+struct nat_impair_stats {
+	u32_t probes_dropped;
+	u32_t replies_dropped;
+	u32_t replies_delayed;
+	u32_t replies_duplicated;
+	u32_t outages;
+	/* Timeouts recorded although the reply arrived. Each one moved the
+	 * upper bound of the search below the NAT timeout.
+	 */
+	u32_t wrong_decisions;
+	/* Timeouts after a dropped probe, the real outcome is unknown */
+	u32_t forced_timeouts;
+	/* Intervals repeated because of an emulated outage */
+	u32_t repeated;
+	/* Test time spent waiting for delayed or dropped replies and on
+	 * repeated intervals
+	 */
+	u32_t extra_ms;
+};
+
+/* Reply held back by the emulator */
+struct nat_impair_held {
+	struct nat_json_reply reply;
+	int len;
+};
+
+#if defined(CONFIG_NAT_TEST_IMPAIR)
+
+/**
+ * @brief Function for initializing the impairment emulator
+ */
+void nat_impair_init(void);
+
+/**
+ * @brief Function to set the impairments of the following probes
+ *
+ * Outages take effect at the next test start.
+ *
+ * @return 0 on success, -EINVAL if a value is out of range.
+ */
+int nat_impair_config_set(const struct nat_impair_config *config);
+
+/**
+ * @brief Function to get the current impairments
+ */
+void nat_impair_config_get(struct nat_impair_config *config);
+
+/**
+ * @brief Function to set one impairment by name
+ *
+ * @param name Field name of struct nat_impair_config, e.g. "loss_down"
+ * @param value New value
+ *
+ * @return 0 on success, -ENOENT for an unknown name, -EINVAL if the value
+ *	   is out of range.
+ */
+int nat_impair_param_set(const char *name, int value);
+
+/**
+ * @brief Function to iterate over the impairments by name
+ *
+ * @param index Index of the impairment
+ * @param name Output, field name
+ * @param value Output, current value
+ *
+ * @return 0 on success, -ENOENT if index is past the last impairment.
+ */
+int nat_impair_param_get(size_t index, const char **name, int *value);
+
+/**
+ * @brief Function to load a predefined scenario
+ *
+ * @param name Scenario name, "none" disables all impairments
+ *
+ * @return 0 on success, -ENOENT for an unknown scenario.
+ */
+int nat_impair_scenario_set(const char *name);
+
+/**
+ * @brief Function to get the name of the active scenario
+ *
+ * @return Scenario name, or "custom" if impairments were changed after
+ *	   loading it.
+ */
+const char *nat_impair_scenario_get(void);
+
+/**
+ * @brief Function to get the name of a predefined scenario
+ *
+ * @return Scenario name, or NULL if index is past the last scenario.
+ */
+const char *nat_impair_scenario_name(size_t index);
+
+/**
+ * @brief Function to get the impact on the current or last test
+ */
+void nat_impair_stats_get(struct nat_impair_stats *stats);
+
+/**
+ * @brief Function to reset statistics and schedule outages, called at test
+ * start
+ */
+void nat_impair_test_start(void);
+
+/**
+ * @brief Function to end running outages and log the impact, called at
+ * test end
+ */
+void nat_impair_test_end(void);
+
+/**
+ * @brief Function to check for an emulated registration outage
+ */
+bool nat_impair_outage_active(void);
+
+/**
+ * @brief Function to decide the fate of a probe about to be sent
+ *
+ * Also forgets replies still held back for the previous probe.
+ *
+ * @param slot Probe slot, less than CONFIG_NAT_TEST_MAX_PROBES
+ *
+ * @return true if the probe is lost and must not be sent.
+ */
+bool nat_impair_probe_send(int slot);
+
+/**
+ * @brief Function to decide the fate of the reply to the probe in flight
+ *
+ * @param slot Probe slot
+ * @param reply Parsed reply, copied if it is held back
+ * @param len Reply length
+ * @param recv_ms Uptime when the reply was received
+ * @param deadline_ms Uptime when the probe times out. Replies delayed
+ *		      beyond it are dropped.
+ *
+ * @return Action to take.
+ */
+enum nat_impair_action nat_impair_reply(int slot,
+					const struct nat_json_reply *reply,
+					int len, s64_t recv_ms,
+					s64_t deadline_ms);
+
+/**
+ * @brief Function to get the release time of a held back reply
+ *
+ * @param slot Probe slot
+ *
+ * @return Uptime in milliseconds, or INT64_MAX if no reply is held back.
+ */
+s64_t nat_impair_release_ms(int slot);
+
+/**
+ * @brief Function to take a held back reply once it is due
+ *
+ * @param slot Probe slot
+ * @param now Current uptime in milliseconds
+ * @param held Output, the reply
+ *
+ * @return true if a reply is due.
+ */
+bool nat_impair_release(int slot, s64_t now, struct nat_impair_held *held);
+
+/**
+ * @brief Function to account for the outcome of an interval
+ *
+ * @param slot Probe slot
+ * @param result Probe result, 1 on reply and 0 on timeout
+ * @param contaminated true if the interval is repeated
+ * @param wait_ms Time spent on the interval
+ */
+void nat_impair_probe_outcome(int slot, int result, bool contaminated,
+			      s64_t wait_ms);
+
+#else
+
+static inline void nat_impair_init(void)
+{
+}
+
+static inline void nat_impair_test_start(void)
+{
+}
+
+static inline void nat_impair_test_end(void)
+{
+}
+
+static inline bool nat_impair_outage_active(void)
+{
+	return false;
+}
+
+static inline bool nat_impair_probe_send(int slot)
+{
+	return false;
+}
+
+static inline enum nat_impair_action
+nat_impair_reply(int slot, const struct nat_json_reply *reply, int len,
+		 s64_t recv_ms, s64_t deadline_ms)
+{
+	return NAT_IMPAIR_PASS;
+}
+
+static inline s64_t nat_impair_release_ms(int slot)
+{
+	return INT64_MAX;
+}
+
+static inline bool nat_impair_release(int slot, s64_t now,
+				      struct nat_impair_held *held)
+{
+	return false;
+}
+
+static inline void nat_impair_probe_outcome(int slot, int result,
+					    bool contaminated, s64_t wait_ms)
+{
+}
+
+#endif /* CONFIG_NAT_TEST_IMPAIR */
+
+#endif /* NAT_IMPAIR_H_ */
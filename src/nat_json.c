@@ -0,0 +1,382 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+#include <zephyr.h>
+#include <logging/log.h>
+#include <cJSON.h>
+#include <stdio.h>
+
+#include "nat_json.h"
+
+LOG_MODULE_REGISTER(nat_json, CONFIG_NAT_TEST_LOG_LEVEL);
+
+#define ARENA_ALIGN 8
+#define IP_STRINGS_COUNT 10
+
+static u8_t arena[CONFIG_NAT_TEST_JSON_ARENA_SIZE] __aligned(ARENA_ALIGN);
+static size_t arena_used;
+static u32_t arena_live;
+static struct nat_json_arena_stats arena_stats;
+
+static void *arena_malloc(size_t size)
+{
+	void *ptr;
+
+	size = ROUND_UP(size, ARENA_ALIGN);
+
+	if (size > sizeof(arena) - arena_used) {
+		arena_stats.failed_count++;
+		return NULL;
+	}
+
+	ptr = &arena[arena_used];
+	arena_used += size;
+	arena_live++;
+
+	arena_stats.alloc_count++;
+	if (arena_used > arena_stats.peak) {
+		arena_stats.peak = arena_used;
+	}
+
+	return ptr;
+}
+
+static void arena_free(void *ptr)
+{
+	if (ptr == NULL || arena_live == 0) {
+		return;
+	}
+
+	/* Blocks are not reused individually, the whole arena is rewound
+	 * once nothing is allocated anymore.
+	 */
+	if (--arena_live == 0) {
+		arena_used = 0;
+	}
+}
+
+void nat_json_init(void)
+{
+	cJSON_Hooks hooks = {
+		.malloc_fn = arena_malloc,
+		.free_fn = arena_free,
+	};
+
+	cJSON_InitHooks(&hooks);
+}
+
+void nat_json_arena_reset(void)
+{
+	if (arena_live > 0) {
+		LOG_WRN("%d JSON allocations leaked", arena_live);
+	}
+
+	arena_live = 0;
+	arena_used = 0;
+}
+
+void nat_json_arena_stats_get(struct nat_json_arena_stats *stats)
+{
+	*stats = arena_stats;
+	stats->size = sizeof(arena);
+	stats->used = arena_used;
+}
+
+void nat_json_arena_peak_reset(void)
+{
+	arena_stats.peak = arena_used;
+}
+
+static int json_add_obj(cJSON *parent, const char *str, cJSON *item)
+{
+	cJSON_AddItemToObject(parent, str, item);
+
+	return 0;
+}
+
+static int json_add_str(cJSON *parent, const char *str, const char *item)
+{
+	cJSON *json_str;
+
+	json_str = cJSON_CreateString(item);
+	if (json_str == NULL) {
+		return -ENOMEM;
+	}
+
+	return json_add_obj(parent, str, json_str);
+}
+
+static int json_add_number(cJSON *parent, const char *str, double item)
+{
+	cJSON *json_num;
+
+	json_num = cJSON_CreateNumber(item);
+	if (json_num == NULL) {
+		return -ENOMEM;
+	}
+
+	return json_add_obj(parent, str, json_num);
+}
+
+int nat_json_probe_encode(const struct nat_json_probe *probe,
+			  struct modem_param_info *const modem_params,
+			  char *buffer, size_t size)
+{
+	int ret = 0;
+	cJSON *root_obj = cJSON_CreateObject();
+	cJSON *ip_obj;
+	const char *delim = " ";
+	const char *ip_strings[IP_STRINGS_COUNT];
+	int ip_count = 0;
+	char *save;
+	char ip_address[sizeof(modem_params->network.ip_address.value_string)];
+
+	if (root_obj == NULL) {
+		LOG_ERR("Failed to create json root object");
+		return -ENOMEM;
+	}
+
+	/* Tokenize a copy, the modem parameters are reused for every probe */
+	strncpy(ip_address, modem_params->network.ip_address.value_string,
+		sizeof(ip_address) - 1);
+	ip_address[sizeof(ip_address) - 1] = '\0';
+
+	char *token = strtok_r(ip_address, delim, &save);
+	while (token != NULL) {
+		if (ip_count >= ARRAY_SIZE(ip_strings)) {
+			LOG_WRN("More than %d addresses found. Remainder will not be added to json",
+			       IP_STRINGS_COUNT);
+			break;
+		}
+		ip_strings[ip_count] = token;
+		token = strtok_r(NULL, delim, &save);
+		ip_count++;
+	}
+
+	ip_obj = cJSON_CreateStringArray(ip_strings, ip_count);
+	if (ip_obj == NULL) {
+		LOG_ERR("Failed to create json ip object");
+		ret = -ENOMEM;
+		goto exit;
+	}
+
+	ret += json_add_obj(root_obj, "ip", ip_obj);
+	ret += json_add_str(
+		root_obj, "op",
+		modem_params->network.current_operator.value_string);
+	ret += json_add_number(root_obj, "cell_id",
+			       modem_params->network.cellid_dec);
+	ret += json_add_number(root_obj, "ue_mode",
+			       modem_params->network.ue_mode.value);
+	ret += json_add_number(root_obj, "lte_mode",
+			       modem_params->network.lte_mode.value);
+	ret += json_add_number(root_obj, "nbiot_mode",
+			       modem_params->network.nbiot_mode.value);
+	ret += json_add_str(root_obj, "iccid",
+			    modem_params->sim.iccid.value_string);
+	ret += json_add_str(root_obj, "imei",
+			    modem_params->device.imei.value_string);
+	ret += json_add_number(root_obj, "interval", probe->interval);
+	ret += json_add_number(root_obj, "seq", probe->seq);
+	ret += json_add_number(root_obj, "nonce", probe->nonce);
+
+	if (probe->type == TEST_UDP_REBIND) {
+		/* Ask for an immediate echo, the device does the waiting */
+		ret += json_add_str(root_obj, "mode", "rebind");
+	}
+
+	if (ret) {
+		LOG_ERR("Failed to add json value");
+		ret = -ENOMEM;
+		goto exit;
+	}
+
+	/* Print straight into the send buffer instead of a heap string */
+	if (!cJSON_PrintPreallocated(root_obj, buffer, size, true)) {
+		LOG_ERR("Failed to print json object");
+		ret = -ENOMEM;
+		goto exit;
+	}
+
+	ret = strlen(buffer);
+
+exit:
+	cJSON_Delete(root_obj);
+
+	return ret;
+}
+
+static bool json_get_number(const cJSON *parent, const char *str,
+			    double *value)
+{
+	const cJSON *item = cJSON_GetObjectItem(parent, str);
+
+	if (!cJSON_IsNumber(item)) {
+		return false;
+	}
+
+	*value = item->valuedouble;
+
+	return true;
+}
+
+void nat_json_reply_parse(const char *buffer, struct nat_json_reply *reply)
+{
+	cJSON *root_obj;
+	cJSON *ip_obj;
+	double seq;
+	double nonce;
+	double port;
+	double recv_ts;
+	double send_ts;
+
+	memset(reply, 0, sizeof(*reply));
+
+	/* Error replies are plain text */
+	reply->error = strstr(buffer, "error") != NULL ||
+		       strstr(buffer, "Error") != NULL;
+
+	root_obj = cJSON_Parse(buffer);
+	if (root_obj == NULL) {
+		return;
+	}
+
+	if (json_get_number(root_obj, "seq", &seq) &&
+	    json_get_number(root_obj, "nonce", &nonce)) {
+		reply->has_id = true;
+		reply->seq = (u32_t)seq;
+		reply->nonce = (u32_t)nonce;
+	}
+
+	ip_obj = cJSON_GetObjectItem(root_obj, "ext_ip");
+
+	if (cJSON_IsString(ip_obj) &&
+	    json_get_number(root_obj, "ext_port", &port)) {
+		reply->has_mapping = true;
+		strncpy(reply->mapping.ip, ip_obj->valuestring,
+			sizeof(reply->mapping.ip) - 1);
+		reply->mapping.port = (u16_t)port;
+	}
+
+	if (json_get_number(root_obj, "recv_ts", &recv_ts) &&
+	    json_get_number(root_obj, "send_ts", &send_ts)) {
+		reply->has_timestamps = true;
+		reply->recv_ts = (s64_t)recv_ts;
+		reply->send_ts = (s64_t)send_ts;
+	}
+
+	cJSON_Delete(root_obj);
+}
+
+static cJSON *result_encode(const struct nat_result *result)
+{
+	/* Order documented in README.md */
+	const double values[] = {
+		result->id,	     result->type,
+		result->rat,	     result->cell_id,
+		result->timeout,     result->lower,
+		result->upper,	     result->probe_count,
+		result->total_wait_s, result->contaminated,
+	};
+	cJSON *array = cJSON_CreateArray();
+	cJSON *item;
+	char operator[NAT_RESULT_OPERATOR_SIZE + 1] = { 0 };
+
+	if (array == NULL) {
+		return NULL;
+	}
+
+	memcpy(operator, result->operator, NAT_RESULT_OPERATOR_SIZE);
+
+	for (size_t i = 0; i < ARRAY_SIZE(values); i++) {
+		item = cJSON_CreateNumber(values[i]);
+		if (item == NULL) {
+			goto error;
+		}
+		cJSON_AddItemToArray(array, item);
+	}
+
+	item = cJSON_CreateString(operator);
+	if (item == NULL) {
+		goto error;
+	}
+	cJSON_AddItemToArray(array, item);
+
+	return array;
+
+error:
+	cJSON_Delete(array);
+	return NULL;
+}
+
+int nat_json_results_encode(const struct nat_result *results, size_t count,
+			    const char *imei, char *buffer, size_t size)
+{
+	int ret = 0;
+	cJSON *root_obj = cJSON_CreateObject();
+	cJSON *results_obj;
+	cJSON *result_obj;
+
+	if (root_obj == NULL) {
+		return -ENOMEM;
+	}
+
+	results_obj = cJSON_CreateArray();
+	if (results_obj == NULL) {
+		ret = -ENOMEM;
+		goto exit;
+	}
+
+	ret += json_add_str(root_obj, "imei", imei);
+	ret += json_add_obj(root_obj, "results", results_obj);
+
+	for (size_t i = 0; i < count; i++) {
+		result_obj = result_encode(&results[i]);
+		if (result_obj == NULL) {
+			ret = -ENOMEM;
+			goto exit;
+		}
+		cJSON_AddItemToArray(results_obj, result_obj);
+	}
+
+	if (ret) {
+		ret = -ENOMEM;
+		goto exit;
+	}
+
+	if (!cJSON_PrintPreallocated(root_obj, buffer, size, false)) {
+		ret = -ENOMEM;
+		goto exit;
+	}
+
+	ret = strlen(buffer);
+
+exit:
+	cJSON_Delete(root_obj);
+
+	return ret;
+}
+
+int nat_json_results_ack_parse(const char *buffer, u32_t *last)
+{
+	cJSON *root_obj;
+	double ack;
+	int err = -EINVAL;
+
+	root_obj = cJSON_Parse(buffer);
+	if (root_obj == NULL) {
+		return -EINVAL;
+	}
+
+	if (json_get_number(root_obj, "ack", &ack)) {
+		*last = (u32_t)ack;
+		err = 0;
+	}
+
+	cJSON_Delete(root_obj);
+
+	return err;
+}
@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+#ifndef NAT_JSON_H_
+#define NAT_JSON_H_
+
+#include <zephyr.h>
+#include <modem/modem_info.h>
+
+#include "nat_test.h"
+#include "nat_results.h"
+
+#define NAT_JSON_EXT_IP_SIZE 46
+
+/* Fields of a probe besides the modem parameters */
+struct nat_json_probe {
+	enum test_type type;
+	int interval;
+	u32_t seq;
+	u32_t nonce;
+};
+
+/* Public address and port of a probe as observed by the server */
+struct nat_json_mapping {
+	char ip[NAT_JSON_EXT_IP_SIZE];
+	u16_t port;
+};
+
+/* Fields echoed and added by the server in its reply */
+struct nat_json_reply {
+	bool error;
+	bool has_id;
+	u32_t seq;
+	u32_t nonce;
+	bool has_mapping;
+	struct nat_json_mapping mapping;
+	/* Server clock in milliseconds when the probe was received and the
+	 * reply was sent.
+	 */
+	bool has_timestamps;
+	s64_t recv_ts;
+	s64_t send_ts;
+};
+
+struct nat_json_arena_stats {
+	size_t size;
+	/* Bytes handed out since the arena was last rewound */
+	size_t used;
+	/* Highest value of used since boot or last reset */
+	size_t peak;
+	u32_t alloc_count;
+	u32_t failed_count;
+};
+
+/**
+ * @brief Function for initializing the JSON allocator
+ *
+ * Installs cJSON allocator hooks that serve all cJSON allocations from a
+ * static arena instead of the system heap. The arena is rewound whenever
+ * the last live allocation is freed. It is not locked, so cJSON must only
+ * be used from the test thread.
+ */
+void nat_json_init(void);
+
+/**
+ * @brief Function to rewind the arena after a probe
+ *
+ * Any allocation still live is leaked into the next probe, so this logs a
+ * warning if there are any.
+ */
+void nat_json_arena_reset(void);
+
+/**
+ * @brief Function to get arena statistics
+ *
+ * @param stats Arena statistics
+ */
+void nat_json_arena_stats_get(struct nat_json_arena_stats *stats);
+
+/**
+ * @brief Function to reset the arena peak
+ */
+void nat_json_arena_peak_reset(void);
+
+/**
+ * @brief Function to encode a probe
+ *
+ * @param probe Probe fields
+ * @param modem_params Modem parameters added to the probe
+ * @param buffer Output buffer, the result is null terminated
+ * @param size Size of the output buffer
+ *
+ * @return Length of the encoded probe, or a negative error code.
+ */
+int nat_json_probe_encode(const struct nat_json_probe *probe,
+			  struct modem_param_info *const modem_params,
+			  char *buffer, size_t size);
+
+/**
+ * @brief Function to parse a server reply
+ *
+ * Fields missing from the reply are flagged as such, so this never fails.
+ *
+ * @param buffer Null terminated reply
+ * @param reply Parsed reply
+ */
+void nat_json_reply_parse(const char *buffer, struct nat_json_reply *reply);
+
+/**
+ * @brief Function to encode a batch of results for upload
+ *
+ * Results are encoded as arrays without keys to keep the message small.
+ *
+ * @param results Results to encode
+ * @param count Number of results
+ * @param imei Device identity
+ * @param buffer Output buffer, the result is null terminated
+ * @param size Size of the output buffer
+ *
+ * @return Length of the encoded message, or -ENOMEM if it does not fit.
+ */
+int nat_json_results_encode(const struct nat_result *results, size_t count,
+			    const char *imei, char *buffer, size_t size);
+
+/**
+ * @brief Function to parse the server acknowledgement of a result upload
+ *
+ * @param buffer Null terminated reply
+ * @param last Id of the last result the server stored
+ *
+ * @return 0 on success, -EINVAL if the reply is not an acknowledgement.
+ */
+int nat_json_results_ack_parse(const char *buffer, u32_t *last);
+
+#endif /* NAT_JSON_H_ */
@@ -0,0 +1,243 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+#include <zephyr.h>
+#include <logging/log.h>
+#include <dk_buttons_and_leds.h>
+
+#include "nat_test.h"
+#include "nat_event.h"
+#include "nat_led.h"
+#include "nat_recovery.h"
+
+LOG_MODULE_REGISTER(nat_led, CONFIG_NAT_TEST_LOG_LEVEL);
+
+#define BLINK_PERIOD_MS 1000
+#define BLINK_FAST_PERIOD_MS 250
+/* A finished test can sit for hours, flash briefly and rarely */
+#define FLASH_ON_MS 100
+#define FLASH_PERIOD_MS 5000
+#define ALL_LEDS_MSK (DK_LED1_MSK | DK_LED2_MSK | DK_LED3_MSK | DK_LED4_MSK)
+#define TEST_TYPE_COUNT (TEST_TCP_KEEPALIVE + 1)
+
+static const char *const pattern_names[] = {
+	[NAT_LED_PATTERN_IDLE] = "idle",
+	[NAT_LED_PATTERN_WAITING] = "waiting",
+	[NAT_LED_PATTERN_SEARCH] = "search",
+	[NAT_LED_PATTERN_NARROW] = "narrow",
+	[NAT_LED_PATTERN_VERIFY] = "verify",
+	[NAT_LED_PATTERN_LINK_LOST] = "link_lost",
+};
+
+BUILD_ASSERT(ARRAY_SIZE(pattern_names) == NAT_LED_PATTERN_COUNT,
+	     "Pattern name missing");
+
+/* Written by the event listener in the emitting thread */
+static atomic_t test_running;
+static atomic_t link_lost;
+static atomic_t current_test;
+/* Search progress per test type, as a pattern */
+static atomic_t phases[TEST_TYPE_COUNT];
+/* Bit per test type that has sent a probe and not finished yet */
+static atomic_t probing;
+
+/* Only used from the LED work */
+static struct k_delayed_work led_work;
+static u32_t step;
+static atomic_t shown;
+
+const char *nat_led_pattern_name(enum nat_led_pattern pattern)
+{
+	if (pattern >= NAT_LED_PATTERN_COUNT) {
+		return "unknown";
+	}
+
+	return pattern_names[pattern];
+}
+
+enum nat_led_pattern nat_led_pattern_get(void)
+{
+	return atomic_get(&shown);
+}
+
+static enum nat_led_pattern pattern_current(void)
+{
+	if (atomic_get(&link_lost)) {
+		return NAT_LED_PATTERN_LINK_LOST;
+	}
+
+	if (!atomic_get(&test_running)) {
+		return NAT_LED_PATTERN_IDLE;
+	}
+
+	return atomic_get(&phases[atomic_get(&current_test)]);
+}
+
+static void led_work_fn(struct k_work *work)
+{
+	enum nat_led_pattern pattern = pattern_current();
+	int period_ms = BLINK_PERIOD_MS;
+	bool blink_on = (step % 2) == 0;
+	u32_t leds;
+
+	if (atomic_set(&shown, pattern) != pattern) {
+		step = 0;
+		blink_on = true;
+	}
+
+	/* The test phases wait up to hours for a reply, so they are static
+	 * and do not wake up the system. Each phase adds one LED.
+	 */
+	switch (pattern) {
+	case NAT_LED_PATTERN_WAITING:
+		leds = DK_LED1_MSK;
+		period_ms = 0;
+		break;
+	case NAT_LED_PATTERN_SEARCH:
+		leds = DK_LED1_MSK | DK_LED2_MSK;
+		period_ms = 0;
+		break;
+	case NAT_LED_PATTERN_NARROW:
+		leds = DK_LED1_MSK | DK_LED2_MSK | DK_LED3_MSK;
+		period_ms = 0;
+		break;
+	case NAT_LED_PATTERN_VERIFY:
+		leds = ALL_LEDS_MSK;
+		period_ms = 0;
+		break;
+	case NAT_LED_PATTERN_LINK_LOST:
+		leds = blink_on ? DK_LED4_MSK : DK_NO_LEDS_MSK;
+		if (nat_recovery_tier_get() > NAT_RECOVERY_TIER_WAIT) {
+			period_ms = BLINK_FAST_PERIOD_MS;
+		}
+		break;
+	case NAT_LED_PATTERN_IDLE:
+	default:
+		leds = blink_on ? ALL_LEDS_MSK : DK_NO_LEDS_MSK;
+		period_ms = blink_on ? FLASH_ON_MS :
+				       FLASH_PERIOD_MS - FLASH_ON_MS;
+		break;
+	}
+
+	dk_set_leds(leds);
+	step++;
+
+	if (period_ms > 0) {
+		k_delayed_work_submit(&led_work, K_MSEC(period_ms));
+	}
+}
+
+static void phase_advance(int test, enum nat_led_pattern from,
+			  enum nat_led_pattern to)
+{
+	if (test < 0 || test >= ARRAY_SIZE(phases)) {
+		return;
+	}
+
+	atomic_set(&current_test, test);
+	(void)atomic_cas(&phases[test], from, to);
+}
+
+/* Shows a test that is still probing instead of the finished one, or
+ * waiting if there is none yet
+ */
+static void test_finish(int test)
+{
+	if (test < 0 || test >= ARRAY_SIZE(phases)) {
+		return;
+	}
+
+	atomic_clear_bit(&probing, test);
+	atomic_set(&phases[test], NAT_LED_PATTERN_WAITING);
+
+	for (int i = 0; i < ARRAY_SIZE(phases); i++) {
+		if (atomic_test_bit(&probing, i)) {
+			atomic_set(&current_test, i);
+			return;
+		}
+	}
+}
+
+static void event_listener(const struct nat_event *evt)
+{
+	enum nat_led_pattern before = pattern_current();
+
+	switch (evt->type) {
+	case NAT_EVENT_TEST_STARTED:
+		for (size_t i = 0; i < ARRAY_SIZE(phases); i++) {
+			atomic_set(&phases[i], NAT_LED_PATTERN_WAITING);
+		}
+		atomic_set(&current_test, TEST_UDP);
+		atomic_set(&probing, 0);
+		atomic_set(&test_running, true);
+		break;
+	case NAT_EVENT_TEST_STOPPED:
+		atomic_set(&test_running, false);
+		break;
+	case NAT_EVENT_PROBE_SENT:
+		if (evt->test >= 0 && evt->test < ARRAY_SIZE(phases)) {
+			atomic_set_bit(&probing, evt->test);
+		}
+		phase_advance(evt->test, NAT_LED_PATTERN_WAITING,
+			      NAT_LED_PATTERN_SEARCH);
+		break;
+	case NAT_EVENT_PROBE_TIMEOUT:
+	case NAT_EVENT_MAPPING_CHANGED:
+		/* The first expired interval starts the binary search */
+		phase_advance(evt->test, NAT_LED_PATTERN_SEARCH,
+			      NAT_LED_PATTERN_NARROW);
+		break;
+	case NAT_EVENT_RESULT:
+		if (!nat_test_verify_follows(evt->test, evt->interval)) {
+			test_finish(evt->test);
+			break;
+		}
+
+		phase_advance(evt->test, NAT_LED_PATTERN_NARROW,
+			      NAT_LED_PATTERN_VERIFY);
+		phase_advance(evt->test, NAT_LED_PATTERN_SEARCH,
+			      NAT_LED_PATTERN_VERIFY);
+		break;
+	case NAT_EVENT_VERIFY_RESULT:
+		test_finish(evt->test);
+		break;
+	case NAT_EVENT_LINK_LOST:
+		atomic_set(&link_lost, true);
+		break;
+	case NAT_EVENT_LINK_RECOVERED:
+		atomic_set(&link_lost, false);
+		break;
+	default:
+		return;
+	}
+
+	if (pattern_current() != before) {
+		k_delayed_work_submit(&led_work, K_NO_WAIT);
+	}
+}
+
+int nat_led_init(void)
+{
+	int err;
+
+	err = dk_leds_init();
+	if (err) {
+		LOG_ERR("LEDs could not be initialised: %d", err);
+		return err;
+	}
+
+	k_delayed_work_init(&led_work, led_work_fn);
+
+	err = nat_event_listener_add(event_listener);
+	if (err) {
+		LOG_ERR("No event listener slot for the LEDs");
+		return err;
+	}
+
+	k_delayed_work_submit(&led_work, K_NO_WAIT);
+
+	return 0;
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+#ifndef NAT_LED_H_
+#define NAT_LED_H_
+
+#include <zephyr.h>
+
+enum nat_led_pattern {
+	/* No test running, LEDs 1-4 flash briefly every 5 s */
+	NAT_LED_PATTERN_IDLE,
+	/* Test started, first probe not sent yet, LED 1 on */
+	NAT_LED_PATTERN_WAITING,
+	/* Interval grows until the first timeout, LEDs 1-2 on */
+	NAT_LED_PATTERN_SEARCH,
+	/* Binary search between the bounds, LEDs 1-3 on */
+	NAT_LED_PATTERN_NARROW,
+	/* Keep-alive verification, LEDs 1-4 on */
+	NAT_LED_PATTERN_VERIFY,
+	/* LTE link lost, LED 4 blinks, fast while the link is cycled */
+	NAT_LED_PATTERN_LINK_LOST,
+	NAT_LED_PATTERN_COUNT
+};
+
+/**
+ * @brief Function for initializing the status LEDs
+ *
+ * The LEDs are updated from the system work queue in reaction to test
+ * events. Patterns shown while a test runs are static and only wake up
+ * the system when they change, except while the link is lost.
+ *
+ * @return 0 on success, otherwise a negative errno.
+ */
+int nat_led_init(void);
+
+/**
+ * @brief Function to get the pattern currently shown
+ */
+enum nat_led_pattern nat_led_pattern_get(void);
+
+/**
+ * @brief Function to get the name of a pattern
+ */
+const char *nat_led_pattern_name(enum nat_led_pattern pattern);
+
+#endif /* NAT_LED_H_ */
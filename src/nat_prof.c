@@ -0,0 +1,269 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+#include <zephyr.h>
+#include <logging/log.h>
+#if defined(CONFIG_TRACING_CPU_STATS)
+#include <tracing_cpu_stats.h>
+#endif
+
+#include "nat_json.h"
+#include "nat_prof.h"
+
+LOG_MODULE_REGISTER(nat_prof, CONFIG_NAT_TEST_LOG_LEVEL);
+
+#define THREADS_MAX 16
+/* Free blocks held at once while the heap is sampled */
+#define HEAP_SAMPLE_BLOCKS 16
+
+struct thread_stack {
+	char name[CONFIG_THREAD_MAX_NAME_LEN];
+	size_t size;
+	size_t used;
+};
+
+struct thread_foreach_data {
+	struct thread_stack *threads;
+	size_t count;
+	size_t skipped;
+};
+
+static struct nat_prof_probe_stats probe_stats;
+static u32_t probe_start_allocs;
+static size_t heap_peak;
+
+static struct k_delayed_work log_work;
+static struct nat_prof_cpu_window log_cpu_window;
+
+static u32_t json_alloc_count(void)
+{
+	struct nat_json_arena_stats stats;
+
+	nat_json_arena_stats_get(&stats);
+
+	return stats.alloc_count;
+}
+
+void nat_prof_probe_begin(void)
+{
+	probe_start_allocs = json_alloc_count();
+}
+
+void nat_prof_probe_end(void)
+{
+	struct nat_prof_heap_stats heap;
+
+	/* Updates the heap peak */
+	nat_prof_heap_stats_get(&heap);
+
+	probe_stats.probe_count++;
+	probe_stats.last_allocs = json_alloc_count() - probe_start_allocs;
+	if (probe_stats.last_allocs > probe_stats.max_allocs) {
+		probe_stats.max_allocs = probe_stats.last_allocs;
+	}
+}
+
+/* Runs with the thread list locked and interrupts masked, so it only
+ * copies. The callbacks of nat_prof_thread_foreach run after the walk.
+ */
+static void thread_foreach_cb(const struct k_thread *thread, void *user_data)
+{
+	struct thread_foreach_data *data = user_data;
+	struct thread_stack *ts;
+	size_t unused = 0;
+	const char *name = k_thread_name_get((k_tid_t)thread);
+
+	if (data->count >= THREADS_MAX) {
+		data->skipped++;
+		return;
+	}
+
+	if (k_thread_stack_space_get(thread, &unused) != 0) {
+		return;
+	}
+
+	ts = &data->threads[data->count++];
+	ts->size = thread->stack_info.size;
+	ts->used = ts->size - unused;
+	ts->name[0] = '\0';
+	if (name != NULL) {
+		strncpy(ts->name, name, sizeof(ts->name) - 1);
+		ts->name[sizeof(ts->name) - 1] = '\0';
+	}
+}
+
+void nat_prof_thread_foreach(nat_prof_thread_cb_t cb, void *user_data)
+{
+	struct thread_stack threads[THREADS_MAX];
+	struct thread_foreach_data data = {
+		.threads = threads,
+	};
+
+	k_thread_foreach(thread_foreach_cb, &data);
+
+	for (size_t i = 0; i < data.count; i++) {
+		cb(threads[i].name[0] != '\0' ? threads[i].name : NULL,
+		   threads[i].size, threads[i].used, user_data);
+	}
+
+	if (data.skipped > 0) {
+		LOG_WRN("%d threads not shown", (int)data.skipped);
+	}
+}
+
+/* Allocates the largest block the heap can currently serve, found with a
+ * binary search over trial allocations. Returns NULL if nothing fits.
+ */
+static void *heap_largest_alloc(size_t *size)
+{
+	size_t lower = 0;
+	size_t upper = CONFIG_HEAP_MEM_POOL_SIZE;
+	size_t trial;
+	void *ptr;
+
+	while (upper - lower > sizeof(void *)) {
+		trial = lower + (upper - lower) / 2;
+
+		ptr = k_malloc(trial);
+		if (ptr != NULL) {
+			k_free(ptr);
+			lower = trial;
+		} else {
+			upper = trial;
+		}
+	}
+
+	*size = lower;
+
+	return lower > 0 ? k_malloc(lower) : NULL;
+}
+
+void nat_prof_heap_stats_get(struct nat_prof_heap_stats *stats)
+{
+	void *blocks[HEAP_SAMPLE_BLOCKS];
+	size_t count = 0;
+	size_t size;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->size = CONFIG_HEAP_MEM_POOL_SIZE;
+
+	/* The heap has no statistics API in this Zephyr version. Its free
+	 * space is taken apart into the largest blocks that fit, one after
+	 * the other, and given back. The scheduler is locked so no other
+	 * thread sees the heap while the blocks are held.
+	 */
+	k_sched_lock();
+
+	while (count < ARRAY_SIZE(blocks)) {
+		blocks[count] = heap_largest_alloc(&size);
+		if (blocks[count] == NULL) {
+			break;
+		}
+
+		if (count == 0) {
+			stats->largest_free = size;
+		}
+		stats->free += size;
+		count++;
+	}
+
+	while (count > 0) {
+		k_free(blocks[--count]);
+	}
+
+	k_sched_unlock();
+
+	stats->used = stats->size - MIN(stats->free, stats->size);
+	heap_peak = MAX(heap_peak, stats->used);
+	stats->peak = heap_peak;
+
+	if (stats->free > 0) {
+		stats->fragmentation =
+			100 - (stats->largest_free * 100) / stats->free;
+	}
+}
+
+void nat_prof_probe_stats_get(struct nat_prof_probe_stats *stats)
+{
+	*stats = probe_stats;
+}
+
+int nat_prof_cpu_idle_get(struct nat_prof_cpu_window *window)
+{
+#if defined(CONFIG_TRACING_CPU_STATS)
+	struct cpu_stats stats;
+	u64_t idle;
+	u64_t total;
+
+	cpu_stats_get_ns(&stats);
+
+	idle = stats.idle - window->idle;
+	total = idle + (stats.non_idle - window->non_idle) +
+		(stats.sched - window->sched);
+
+	window->idle = stats.idle;
+	window->non_idle = stats.non_idle;
+	window->sched = stats.sched;
+
+	if (total == 0) {
+		return 100;
+	}
+
+	return (int)((idle * 100) / total);
+#else
+	return -ENOTSUP;
+#endif
+}
+
+void nat_prof_reset(void)
+{
+	nat_json_arena_peak_reset();
+
+	memset(&probe_stats, 0, sizeof(probe_stats));
+	heap_peak = 0;
+}
+
+static void log_thread_cb(const char *name, size_t size, size_t used,
+			  void *user_data)
+{
+	LOG_INF("Stack %s: %d of %d bytes used",
+		log_strdup(name ? name : "unknown"), (int)used, (int)size);
+}
+
+static void log_work_fn(struct k_work *work)
+{
+	struct nat_json_arena_stats arena;
+	struct nat_prof_probe_stats probe;
+	struct nat_prof_heap_stats heap;
+
+	nat_prof_thread_foreach(log_thread_cb, NULL);
+	nat_json_arena_stats_get(&arena);
+	nat_prof_probe_stats_get(&probe);
+	nat_prof_heap_stats_get(&heap);
+
+	LOG_INF("JSON arena: %d of %d bytes, peak %d, %d allocs, %d failed",
+		(int)arena.used, (int)arena.size, (int)arena.peak,
+		arena.alloc_count, arena.failed_count);
+	LOG_INF("Heap: %d of %d bytes, peak %d, largest free %d, fragmentation %d%%",
+		(int)heap.used, (int)heap.size, (int)heap.peak,
+		(int)heap.largest_free, heap.fragmentation);
+	LOG_INF("Probes: %d, allocs last %d, max %d, CPU idle %d%%",
+		probe.probe_count, probe.last_allocs, probe.max_allocs,
+		nat_prof_cpu_idle_get(&log_cpu_window));
+
+	k_delayed_work_submit(&log_work,
+			      K_SECONDS(CONFIG_NAT_TEST_PROFILER_LOG_INTERVAL));
+}
+
+void nat_prof_init(void)
+{
+	if (CONFIG_NAT_TEST_PROFILER_LOG_INTERVAL > 0) {
+		k_delayed_work_init(&log_work, log_work_fn);
+		k_delayed_work_submit(
+			&log_work,
+			K_SECONDS(CONFIG_NAT_TEST_PROFILER_LOG_INTERVAL));
+	}
+}
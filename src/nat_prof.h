@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+#ifndef NAT_PROF_H_
+#define NAT_PROF_H_
+
+#include <zephyr.h>
+
+struct nat_prof_probe_stats {
+	u32_t probe_count;
+	/* JSON arena allocations made while handling the last probe */
+	u32_t last_allocs;
+	/* Highest allocation count of a single probe */
+	u32_t max_allocs;
+};
+
+/* System heap, sampled with trial allocations */
+struct nat_prof_heap_stats {
+	size_t size;
+	/* Heap size minus the free bytes that could be allocated, includes
+	 * the allocator overhead
+	 */
+	size_t used;
+	/* Highest used of all samples, taken after every probe and on every
+	 * report
+	 */
+	size_t peak;
+	size_t free;
+	size_t largest_free;
+	/* Share of the free bytes outside the largest free block, percent */
+	int fragmentation;
+};
+
+/* CPU time counters at the previous read of one reader */
+struct nat_prof_cpu_window {
+	u64_t idle;
+	u64_t non_idle;
+	u64_t sched;
+};
+
+/**
+ * @brief Callback for nat_prof_thread_foreach
+ *
+ * @param name Thread name, or NULL if the thread has no name
+ * @param size Stack size in bytes
+ * @param used Highest stack usage in bytes
+ * @param user_data User data passed to nat_prof_thread_foreach
+ */
+typedef void (*nat_prof_thread_cb_t)(const char *name, size_t size,
+				     size_t used, void *user_data);
+
+#if defined(CONFIG_NAT_TEST_PROFILER)
+
+/**
+ * @brief Function for initializing the profiler
+ */
+void nat_prof_init(void);
+
+/**
+ * @brief Function to mark the start of a probe
+ */
+void nat_prof_probe_begin(void);
+
+/**
+ * @brief Function to mark the end of a probe
+ */
+void nat_prof_probe_end(void);
+
+/**
+ * @brief Function to iterate over all threads and their stack usage
+ *
+ * The stack usage of all threads is collected first, the callback is
+ * called afterwards without any lock held.
+ *
+ * @param cb Callback called for each thread
+ * @param user_data User data passed to the callback
+ */
+void nat_prof_thread_foreach(nat_prof_thread_cb_t cb, void *user_data);
+
+/**
+ * @brief Function to get system heap usage and fragmentation
+ *
+ * Samples the heap with trial allocations while the scheduler is locked, so
+ * it should not be called from time critical code.
+ *
+ * @param stats Heap statistics
+ */
+void nat_prof_heap_stats_get(struct nat_prof_heap_stats *stats);
+
+/**
+ * @brief Function to get per probe allocation statistics
+ *
+ * @param stats Probe statistics
+ */
+void nat_prof_probe_stats_get(struct nat_prof_probe_stats *stats);
+
+/**
+ * @brief Function to get CPU load since the last call with the same window
+ *
+ * The counters are never reset, so every reader keeps its own window and
+ * readers do not shorten each other's measurement.
+ *
+ * @param window Counters of the previous call, updated. Zero initialized
+ *		 for the load since boot.
+ *
+ * @return CPU idle time in percent, or -ENOTSUP if CPU statistics are not
+ *	   available.
+ */
+int nat_prof_cpu_idle_get(struct nat_prof_cpu_window *window);
+
+/**
+ * @brief Function to reset peak and per probe statistics
+ */
+void nat_prof_reset(void);
+
+#else
+
+static inline void nat_prof_init(void)
+{
+}
+
+static inline void nat_prof_probe_begin(void)
+{
+}
+
+static inline void nat_prof_probe_end(void)
+{
+}
+
+#endif /* CONFIG_NAT_TEST_PROFILER */
+
+#endif /* NAT_PROF_H_ */
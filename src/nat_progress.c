@@ -0,0 +1,313 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+#include <zephyr.h>
+#include <logging/log.h>
+#include <math.h>
+
+#include "nat_test.h"
+#include "nat_progress.h"
+
+LOG_MODULE_REGISTER(nat_progress, CONFIG_NAT_TEST_LOG_LEVEL);
+
+/* Bounds the simulation if the multiplier does not grow the timeout */
+#define SIM_MAX_PROBES 64
+
+struct progress_slot {
+	bool active;
+	struct nat_progress_probe probe;
+	u32_t initial_worst_s;
+};
+
+struct sim {
+	int probes;
+	u32_t seconds;
+	int first_cost_s;
+};
+
+static const char *const case_names[] = {
+	[NAT_PROGRESS_CASE_BEST] = "best",
+	[NAT_PROGRESS_CASE_EXPECTED] = "expected",
+	[NAT_PROGRESS_CASE_WORST] = "worst",
+};
+
+BUILD_ASSERT(ARRAY_SIZE(case_names) == NAT_PROGRESS_CASE_COUNT,
+	     "Case name missing");
+
+static struct progress_slot slots[CONFIG_NAT_TEST_MAX_PROBES];
+static struct k_delayed_work log_work;
+/* Set while a test runs, stops the log work from rescheduling itself */
+static atomic_t logging;
+
+const char *nat_progress_case_name(enum nat_progress_case c)
+{
+	if (c >= NAT_PROGRESS_CASE_COUNT) {
+		return "unknown";
+	}
+
+	return case_names[c];
+}
+
+static void sim_add(struct sim *sim, int cost_s)
+{
+	if (sim->probes++ == 0) {
+		sim->first_cost_s = cost_s;
+	}
+
+	sim->seconds += cost_s;
+}
+
+/* Runs the remaining search as nat_test does, assuming the NAT timeout is
+ * true_timeout. Returns the timeout the search would find.
+ */
+static int sim_search(const struct nat_progress_probe *p, int true_timeout,
+		      struct sim *sim)
+{
+	int timeout = p->timeout;
+	int lower = p->lower;
+	int upper = p->upper;
+	bool binary_search = p->binary_search;
+	bool expired;
+
+	for (int i = 0; i < SIM_MAX_PROBES; i++) {
+		expired = timeout > true_timeout;
+		sim_add(sim, timeout + (expired ? p->expire_cost_s :
+						  p->keep_cost_s));
+
+		if (expired) {
+			binary_search = true;
+			upper = timeout;
+		} else if (binary_search) {
+			lower = timeout;
+		} else {
+			lower = timeout;
+			timeout *= p->multiplier;
+			continue;
+		}
+
+		if (upper - lower <= 1) {
+			return lower;
+		}
+
+		timeout = lower + (upper - lower) / 2;
+	}
+
+	return lower;
+}
+
+/* Verification intervals are below the found timeout, so all cycles are
+ * expected to pass.
+ */
+static void sim_verify(const struct nat_progress_probe *p, int found,
+		       int index, int cycles_done, struct sim *sim)
+{
+	int fraction;
+	int interval;
+
+	for (int i = index; i < KEEPALIVE_VERIFY_MAX_FRACTIONS; i++) {
+		fraction = keepalive_verify_fractions[i];
+		if (fraction <= 0) {
+			break;
+		}
+
+		interval = (found * fraction) / 100;
+		if (interval <= 0) {
+			continue;
+		}
+
+		for (int c = i == index ? cycles_done : 0;
+		     c < keepalive_verify_cycles; c++) {
+			sim_add(sim, interval + p->keep_cost_s);
+		}
+	}
+}
+
+static int case_timeout(const struct nat_progress_probe *p,
+			enum nat_progress_case c)
+{
+	int max = MAX(CONFIG_NAT_TEST_PROGRESS_MAX_TIMEOUT, p->timeout);
+
+	switch (c) {
+	case NAT_PROGRESS_CASE_BEST:
+		return p->lower;
+	case NAT_PROGRESS_CASE_EXPECTED:
+		if (p->binary_search) {
+			return p->lower + (p->upper - p->lower) / 2;
+		}
+		/* Timeouts spread over orders of magnitude, so take the
+		 * geometric middle of what is left.
+		 */
+		return (int)sqrt((double)p->timeout * max);
+	case NAT_PROGRESS_CASE_WORST:
+	default:
+		if (p->binary_search) {
+			return p->upper - 1;
+		}
+		return max;
+	}
+}
+
+static void estimate(const struct nat_progress_probe *p, u32_t now_ms,
+		     struct nat_progress_status *status)
+{
+	struct sim sim;
+	int found;
+	u32_t elapsed_s = (now_ms - p->measure_start_ms) / MSEC_PER_SEC;
+
+	status->probe = *p;
+	status->elapsed_s = (now_ms - p->test_start_ms) / MSEC_PER_SEC;
+
+	for (int c = 0; c < NAT_PROGRESS_CASE_COUNT; c++) {
+		memset(&sim, 0, sizeof(sim));
+
+		if (p->verify_phase) {
+			sim_verify(p, p->timeout, p->verify_index,
+				   p->verify_cycles_done, &sim);
+		} else {
+			found = sim_search(p, case_timeout(p, c), &sim);
+			if (p->verify_enabled && found > 0) {
+				sim_verify(p, found, 0, 0, &sim);
+			}
+		}
+
+		/* Part of the current interval has already passed */
+		sim.seconds -= MIN(elapsed_s, (u32_t)sim.first_cost_s);
+
+		status->remaining_probes[c] = sim.probes;
+		status->remaining_s[c] = sim.seconds;
+	}
+}
+
+static void slots_clear(void)
+{
+	unsigned int key = irq_lock();
+
+	for (size_t i = 0; i < ARRAY_SIZE(slots); i++) {
+		slots[i].active = false;
+	}
+	irq_unlock(key);
+}
+
+void nat_progress_test_start(void)
+{
+	slots_clear();
+
+	if (CONFIG_NAT_TEST_PROGRESS_LOG_INTERVAL > 0) {
+		atomic_set(&logging, true);
+		k_delayed_work_submit(
+			&log_work,
+			K_SECONDS(CONFIG_NAT_TEST_PROGRESS_LOG_INTERVAL));
+	}
+}
+
+void nat_progress_test_end(void)
+{
+	slots_clear();
+
+	if (CONFIG_NAT_TEST_PROGRESS_LOG_INTERVAL > 0) {
+		atomic_set(&logging, false);
+		k_delayed_work_cancel(&log_work);
+	}
+}
+
+void nat_progress_update(int slot, const struct nat_progress_probe *probe)
+{
+	unsigned int key;
+	struct nat_progress_status status;
+	bool first;
+
+	if (slot < 0 || slot >= ARRAY_SIZE(slots)) {
+		return;
+	}
+
+	key = irq_lock();
+	first = !slots[slot].active;
+	irq_unlock(key);
+
+	if (first) {
+		estimate(probe, probe->test_start_ms, &status);
+	}
+
+	key = irq_lock();
+	slots[slot].probe = *probe;
+	if (first) {
+		slots[slot].initial_worst_s =
+			status.remaining_s[NAT_PROGRESS_CASE_WORST];
+	}
+	slots[slot].active = true;
+	irq_unlock(key);
+}
+
+void nat_progress_remove(int slot)
+{
+	unsigned int key;
+
+	if (slot < 0 || slot >= ARRAY_SIZE(slots)) {
+		return;
+	}
+
+	key = irq_lock();
+	slots[slot].active = false;
+	irq_unlock(key);
+}
+
+size_t nat_progress_get(struct nat_progress_status *status, size_t max)
+{
+	struct progress_slot slot;
+	unsigned int key;
+	size_t count = 0;
+	u32_t now_ms = k_uptime_get_32();
+
+	for (size_t i = 0; i < ARRAY_SIZE(slots) && count < max; i++) {
+		key = irq_lock();
+		slot = slots[i];
+		irq_unlock(key);
+
+		if (!slot.active) {
+			continue;
+		}
+
+		estimate(&slot.probe, now_ms, &status[count]);
+		status[count].initial_worst_s = slot.initial_worst_s;
+		status[count].behind =
+			status[count].elapsed_s > slot.initial_worst_s;
+		count++;
+	}
+
+	return count;
+}
+
+static void log_work_fn(struct k_work *work)
+{
+	struct nat_progress_status status[CONFIG_NAT_TEST_MAX_PROBES];
+	size_t count = nat_progress_get(status, ARRAY_SIZE(status));
+
+	for (size_t i = 0; i < count; i++) {
+		LOG_INF("%s: %d probes, %d min elapsed, timeout %d s in [%d, %d]",
+			nat_test_type_name(status[i].probe.type),
+			status[i].probe.probe_count, status[i].elapsed_s / 60,
+			status[i].probe.timeout, status[i].probe.lower,
+			status[i].probe.upper);
+		LOG_INF("%s: remaining min best %d, expected %d, worst %d%s",
+			nat_test_type_name(status[i].probe.type),
+			status[i].remaining_s[NAT_PROGRESS_CASE_BEST] / 60,
+			status[i].remaining_s[NAT_PROGRESS_CASE_EXPECTED] / 60,
+			status[i].remaining_s[NAT_PROGRESS_CASE_WORST] / 60,
+			status[i].behind ? ", behind schedule" : "");
+	}
+
+	if (!atomic_get(&logging)) {
+		return;
+	}
+
+	k_delayed_work_submit(&log_work,
+			      K_SECONDS(CONFIG_NAT_TEST_PROGRESS_LOG_INTERVAL));
+}
+
+void nat_progress_init(void)
+{
+	k_delayed_work_init(&log_work, log_work_fn);
+}
@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+#ifndef NAT_PROGRESS_H_
+#define NAT_PROGRESS_H_
+
+#include <zephyr.h>
+
+enum nat_progress_case {
+	/* The timeout equals the current lower bound */
+	NAT_PROGRESS_CASE_BEST,
+	NAT_PROGRESS_CASE_EXPECTED,
+	/* The timeout is just below the upper bound, or
+	 * CONFIG_NAT_TEST_PROGRESS_MAX_TIMEOUT while no upper bound is known
+	 */
+	NAT_PROGRESS_CASE_WORST,
+	NAT_PROGRESS_CASE_COUNT
+};
+
+/* Search state of one probe, published by the test thread whenever a new
+ * interval starts.
+ */
+struct nat_progress_probe {
+	/* Test type, see enum test_type */
+	int type;
+	bool verify_phase;
+	bool binary_search;
+	int timeout;
+	double multiplier;
+	int lower;
+	int upper;
+	/* Seconds a measurement takes beyond its interval when the interval
+	 * is kept or expired
+	 */
+	int keep_cost_s;
+	int expire_cost_s;
+	/* Keep-alive verification, index of the current fraction and cycles
+	 * done in it
+	 */
+	bool verify_enabled;
+	int verify_index;
+	int verify_cycles_done;
+	u16_t probe_count;
+	/* Uptime when the test and the current interval started */
+	u32_t test_start_ms;
+	u32_t measure_start_ms;
+};
+
+struct nat_progress_status {
+	struct nat_progress_probe probe;
+	int remaining_probes[NAT_PROGRESS_CASE_COUNT];
+	u32_t remaining_s[NAT_PROGRESS_CASE_COUNT];
+	u32_t elapsed_s;
+	/* Worst case total duration estimated when the test started */
+	u32_t initial_worst_s;
+	/* The test already took longer than initial_worst_s */
+	bool behind;
+};
+
+/**
+ * @brief Function for initializing progress logging
+ */
+void nat_progress_init(void);
+
+/**
+ * @brief Function to forget all published probes and start logging
+ *
+ * Progress is logged every CONFIG_NAT_TEST_PROGRESS_LOG_INTERVAL seconds
+ * until nat_progress_test_end() is called.
+ */
+void nat_progress_test_start(void);
+
+/**
+ * @brief Function to forget all published probes and stop logging
+ */
+void nat_progress_test_end(void);
+
+/**
+ * @brief Function to publish the state of a probe
+ *
+ * @param slot Probe slot, less than CONFIG_NAT_TEST_MAX_PROBES
+ * @param probe Probe state
+ */
+void nat_progress_update(int slot, const struct nat_progress_probe *probe);
+
+/**
+ * @brief Function to mark a probe as finished
+ *
+ * @param slot Probe slot
+ */
+void nat_progress_remove(int slot);
+
+/**
+ * @brief Function to estimate the remaining time of all running probes
+ *
+ * @param status Output, one entry per running probe
+ * @param max Number of entries in status
+ *
+ * @return Number of running probes written to status.
+ */
+size_t nat_progress_get(struct nat_progress_status *status, size_t max);
+
+/**
+ * @brief Function to get the name of an estimate case
+ */
+const char *nat_progress_case_name(enum nat_progress_case c);
+
+#endif /* NAT_PROGRESS_H_ */
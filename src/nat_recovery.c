@@ -0,0 +1,242 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+#include <zephyr.h>
+#include <logging/log.h>
+#include <modem/lte_lc.h>
+#include <power/reboot.h>
+
+#include "nat_event.h"
+#include "nat_recovery.h"
+
+LOG_MODULE_REGISTER(nat_recovery, CONFIG_NAT_TEST_LOG_LEVEL);
+
+#define RECOVERY_LOG_SIZE 8
+/* Recovery events are not related to a test */
+#define NO_TEST -1
+
+static const char *const reason_names[] = {
+	[NAT_RECOVERY_REASON_SEARCHING] = "searching",
+	[NAT_RECOVERY_REASON_DENIED] = "registration denied",
+	[NAT_RECOVERY_REASON_UICC] = "UICC failure",
+};
+
+BUILD_ASSERT(ARRAY_SIZE(reason_names) == NAT_RECOVERY_REASON_COUNT,
+	     "Reason name missing");
+
+static const char *const tier_names[] = {
+	[NAT_RECOVERY_TIER_NONE] = "none",
+	[NAT_RECOVERY_TIER_WAIT] = "wait",
+	[NAT_RECOVERY_TIER_CYCLE] = "offline/normal cycle",
+	[NAT_RECOVERY_TIER_REBOOT] = "reboot",
+};
+
+BUILD_ASSERT(ARRAY_SIZE(tier_names) == NAT_RECOVERY_TIER_COUNT,
+	     "Tier name missing");
+
+/* Shared with the LTE event handler */
+static atomic_t link_up;
+static atomic_t lost_reason;
+static atomic_t epoch;
+static atomic_t current_tier;
+
+/* Only used from the work handler */
+static struct k_delayed_work recovery_work;
+static struct nat_recovery_record current;
+static s64_t tier_deadline_ms;
+static int tier_attempts;
+
+static struct nat_recovery_record recovery_log[RECOVERY_LOG_SIZE];
+static size_t log_count;
+static size_t log_next;
+
+const char *nat_recovery_reason_name(enum nat_recovery_reason reason)
+{
+	if (reason >= NAT_RECOVERY_REASON_COUNT) {
+		return "unknown";
+	}
+
+	return reason_names[reason];
+}
+
+const char *nat_recovery_tier_name(enum nat_recovery_tier tier)
+{
+	if (tier >= NAT_RECOVERY_TIER_COUNT) {
+		return "unknown";
+	}
+
+	return tier_names[tier];
+}
+
+static void tier_enter(enum nat_recovery_tier tier, int delay_s)
+{
+	atomic_set(&current_tier, tier);
+	if (tier > current.tier) {
+		current.tier = tier;
+	}
+
+	tier_deadline_ms = k_uptime_get() + (s64_t)delay_s * MSEC_PER_SEC;
+	k_delayed_work_submit(&recovery_work, K_SECONDS(delay_s));
+}
+
+static void cycle_start(void)
+{
+	int timeout_s;
+
+	tier_attempts++;
+	timeout_s = CONFIG_NAT_TEST_RECOVERY_CYCLE_TIMEOUT
+		    << (tier_attempts - 1);
+
+	LOG_WRN("Link recovery: offline/normal cycle %d of %d, next step in %d s",
+		tier_attempts, CONFIG_NAT_TEST_RECOVERY_CYCLES, timeout_s);
+
+	lte_lc_offline();
+	lte_lc_normal();
+
+	tier_enter(NAT_RECOVERY_TIER_CYCLE, timeout_s);
+}
+
+static void escalate(void)
+{
+	switch (atomic_get(&current_tier)) {
+	case NAT_RECOVERY_TIER_NONE:
+	case NAT_RECOVERY_TIER_WAIT:
+		tier_attempts = 0;
+		cycle_start();
+		break;
+	case NAT_RECOVERY_TIER_CYCLE:
+		if (tier_attempts < CONFIG_NAT_TEST_RECOVERY_CYCLES) {
+			cycle_start();
+			break;
+		}
+
+		/* Fall through */
+	default:
+		atomic_set(&current_tier, NAT_RECOVERY_TIER_REBOOT);
+		LOG_ERR("LTE link could not be established.");
+		LOG_ERR("Rebooting...");
+		LOG_PANIC();
+		sys_reboot(SYS_REBOOT_WARM);
+		break;
+	}
+}
+
+static void recovery_start(s64_t now)
+{
+	current.reason = atomic_get(&lost_reason);
+	current.tier = NAT_RECOVERY_TIER_NONE;
+	current.start_ms = (u32_t)now;
+
+	LOG_WRN("LTE link lost: %s",
+		nat_recovery_reason_name(current.reason));
+	nat_event_emit(NAT_EVENT_LINK_LOST, NO_TEST, 0, current.reason);
+
+	if (current.reason == NAT_RECOVERY_REASON_SEARCHING) {
+		/* Most outages end while the modem searches on its own */
+		tier_enter(NAT_RECOVERY_TIER_WAIT, CONFIG_NAT_TEST_RECOVERY_WAIT);
+		return;
+	}
+
+	/* Searching longer will not help a rejected registration */
+	escalate();
+}
+
+static void recovery_done(s64_t now)
+{
+	unsigned int key;
+
+	current.duration_ms = (u32_t)now - current.start_ms;
+	atomic_set(&current_tier, NAT_RECOVERY_TIER_NONE);
+
+	LOG_INF("LTE link recovered from %s after %d ms, highest step: %s",
+		nat_recovery_reason_name(current.reason),
+		current.duration_ms, nat_recovery_tier_name(current.tier));
+	nat_event_emit(NAT_EVENT_LINK_RECOVERED, NO_TEST, current.tier,
+		       current.duration_ms);
+
+	key = irq_lock();
+	recovery_log[log_next] = current;
+	log_next = (log_next + 1) % RECOVERY_LOG_SIZE;
+	if (log_count < RECOVERY_LOG_SIZE) {
+		log_count++;
+	}
+	irq_unlock(key);
+}
+
+static void recovery_work_fn(struct k_work *work)
+{
+	s64_t now = k_uptime_get();
+
+	if (atomic_get(&link_up)) {
+		if (atomic_get(&current_tier) != NAT_RECOVERY_TIER_NONE) {
+			recovery_done(now);
+		}
+		return;
+	}
+
+	if (atomic_get(&current_tier) == NAT_RECOVERY_TIER_NONE) {
+		recovery_start(now);
+		return;
+	}
+
+	/* Woken by a link event while the current step is still running */
+	if (now < tier_deadline_ms) {
+		k_delayed_work_submit(&recovery_work,
+				      K_MSEC(tier_deadline_ms - now));
+		return;
+	}
+
+	escalate();
+}
+
+void nat_recovery_init(void)
+{
+	k_delayed_work_init(&recovery_work, recovery_work_fn);
+}
+
+void nat_recovery_link_lost(enum nat_recovery_reason reason)
+{
+	if (atomic_set(&link_up, false)) {
+		atomic_inc(&epoch);
+	}
+
+	if (atomic_get(&current_tier) == NAT_RECOVERY_TIER_NONE) {
+		atomic_set(&lost_reason, reason);
+	}
+
+	k_delayed_work_submit(&recovery_work, K_NO_WAIT);
+}
+
+void nat_recovery_link_up(void)
+{
+	atomic_set(&link_up, true);
+
+	k_delayed_work_submit(&recovery_work, K_NO_WAIT);
+}
+
+u32_t nat_recovery_epoch_get(void)
+{
+	return atomic_get(&epoch);
+}
+
+enum nat_recovery_tier nat_recovery_tier_get(void)
+{
+	return atomic_get(&current_tier);
+}
+
+size_t nat_recovery_log_get(struct nat_recovery_record *records, size_t max)
+{
+	unsigned int key = irq_lock();
+	size_t count = MIN(max, log_count);
+
+	for (size_t i = 0; i < count; i++) {
+		records[i] = recovery_log[(log_next + RECOVERY_LOG_SIZE - 1 - i) %
+					  RECOVERY_LOG_SIZE];
+	}
+	irq_unlock(key);
+
+	return count;
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+#ifndef NAT_RECOVERY_H_
+#define NAT_RECOVERY_H_
+
+#include <zephyr.h>
+
+enum nat_recovery_reason {
+	NAT_RECOVERY_REASON_SEARCHING,
+	NAT_RECOVERY_REASON_DENIED,
+	NAT_RECOVERY_REASON_UICC,
+	NAT_RECOVERY_REASON_COUNT
+};
+
+/* Escalating recovery actions, a full reboot is the last resort */
+enum nat_recovery_tier {
+	NAT_RECOVERY_TIER_NONE,
+	/* Let the modem search on its own */
+	NAT_RECOVERY_TIER_WAIT,
+	/* Cycle between offline and normal mode, with backoff */
+	NAT_RECOVERY_TIER_CYCLE,
+	NAT_RECOVERY_TIER_REBOOT,
+	NAT_RECOVERY_TIER_COUNT
+};
+
+struct nat_recovery_record {
+	enum nat_recovery_reason reason;
+	/* Highest tier reached before the link came back */
+	enum nat_recovery_tier tier;
+	/* Uptime in milliseconds when the link was lost */
+	u32_t start_ms;
+	u32_t duration_ms;
+};
+
+/**
+ * @brief Function for initializing link recovery
+ */
+void nat_recovery_init(void);
+
+/**
+ * @brief Function to report a lost or failed LTE link
+ *
+ * Starts recovery unless it is already running. Safe to call from the LTE
+ * event handler, the recovery actions run on the system work queue.
+ *
+ * @param reason Reason for the link loss
+ */
+void nat_recovery_link_lost(enum nat_recovery_reason reason);
+
+/**
+ * @brief Function to report that the LTE link is up
+ */
+void nat_recovery_link_up(void);
+
+/**
+ * @brief Function to get the link epoch
+ *
+ * The epoch is incremented on every link loss, so a probe can tell if the
+ * link was lost while it was in flight.
+ */
+u32_t nat_recovery_epoch_get(void);
+
+/**
+ * @brief Function to get the most recent recoveries
+ *
+ * @param records Output, newest first
+ * @param max Maximum number of records
+ *
+ * @return Number of records written.
+ */
+size_t nat_recovery_log_get(struct nat_recovery_record *records, size_t max);
+
+/**
+ * @brief Function to get the current recovery tier
+ */
+enum nat_recovery_tier nat_recovery_tier_get(void);
+
+/**
+ * @brief Function to get the name of a recovery reason
+ */
+const char *nat_recovery_reason_name(enum nat_recovery_reason reason);
+
+/**
+ * @brief Function to get the name of a recovery tier
+ */
+const char *nat_recovery_tier_name(enum nat_recovery_tier tier);
+
+#endif /* NAT_RECOVERY_H_ */
@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+#include <zephyr.h>
+#include <device.h>
+#include <drivers/flash.h>
+#include <storage/flash_map.h>
+#include <fs/nvs.h>
+#include <logging/log.h>
+
+#include "nat_results.h"
+
+LOG_MODULE_REGISTER(nat_results, CONFIG_NAT_TEST_LOG_LEVEL);
+
+#define META_ID 1
+#define RECORD_ID_BASE 2
+#define SECTOR_COUNT 3
+
+struct results_meta {
+	u32_t next;
+	u32_t pending;
+};
+
+static struct nvs_fs fs;
+static struct results_meta meta = {
+	.next = 1,
+	.pending = 1,
+};
+static bool initialized;
+
+K_MUTEX_DEFINE(results_mutex);
+
+static u32_t first_id(void)
+{
+	if (meta.next > CONFIG_NAT_TEST_RESULTS_MAX) {
+		return meta.next - CONFIG_NAT_TEST_RESULTS_MAX;
+	}
+
+	return 1;
+}
+
+static u16_t record_id(u32_t id)
+{
+	return RECORD_ID_BASE + (id % CONFIG_NAT_TEST_RESULTS_MAX);
+}
+
+int nat_results_init(void)
+{
+	int err;
+	ssize_t len;
+	const struct flash_area *fa;
+	struct flash_pages_info info;
+
+	err = flash_area_open(FLASH_AREA_ID(storage), &fa);
+	if (err) {
+		LOG_ERR("Storage partition could not be opened: %d", err);
+		return err;
+	}
+
+	err = flash_get_page_info_by_offs(device_get_binding(fa->fa_dev_name),
+					  fa->fa_off, &info);
+	if (err) {
+		LOG_ERR("Flash page info could not be read: %d", err);
+		flash_area_close(fa);
+		return err;
+	}
+
+	fs.offset = fa->fa_off;
+	fs.sector_size = info.size;
+	fs.sector_count = MIN(SECTOR_COUNT, fa->fa_size / info.size);
+
+	err = nvs_init(&fs, fa->fa_dev_name);
+	flash_area_close(fa);
+	if (err) {
+		LOG_ERR("Result store could not be mounted: %d", err);
+		return err;
+	}
+
+	len = nvs_read(&fs, META_ID, &meta, sizeof(meta));
+	if (len != sizeof(meta)) {
+		meta.next = 1;
+		meta.pending = 1;
+	}
+
+	initialized = true;
+
+	LOG_INF("%d results stored, %d pending upload",
+		meta.next - first_id(), meta.next - MAX(meta.pending, first_id()));
+
+	return 0;
+}
+
+int nat_results_store(struct nat_result *result)
+{
+	ssize_t len;
+	struct results_meta new_meta;
+
+	if (!initialized) {
+		return -ENODEV;
+	}
+
+	k_mutex_lock(&results_mutex, K_FOREVER);
+
+	result->id = meta.next;
+
+	len = nvs_write(&fs, record_id(result->id), result, sizeof(*result));
+	if (len < 0) {
+		k_mutex_unlock(&results_mutex);
+		LOG_ERR("Result could not be stored: %d", (int)len);
+		return len;
+	}
+
+	new_meta = meta;
+	new_meta.next++;
+
+	len = nvs_write(&fs, META_ID, &new_meta, sizeof(new_meta));
+	if (len < 0) {
+		k_mutex_unlock(&results_mutex);
+		LOG_ERR("Result index could not be stored: %d", (int)len);
+		return len;
+	}
+
+	meta = new_meta;
+	k_mutex_unlock(&results_mutex);
+
+	return 0;
+}
+
+int nat_results_read(u32_t id, struct nat_result *result)
+{
+	ssize_t len;
+
+	if (!initialized) {
+		return -ENODEV;
+	}
+
+	k_mutex_lock(&results_mutex, K_FOREVER);
+
+	if (id < first_id() || id >= meta.next) {
+		k_mutex_unlock(&results_mutex);
+		return -ENOENT;
+	}
+
+	len = nvs_read(&fs, record_id(id), result, sizeof(*result));
+	k_mutex_unlock(&results_mutex);
+
+	if (len != sizeof(*result) || result->id != id) {
+		return -ENOENT;
+	}
+
+	return 0;
+}
+
+void nat_results_range(u32_t *first, u32_t *next, u32_t *pending)
+{
+	k_mutex_lock(&results_mutex, K_FOREVER);
+	*first = first_id();
+	*next = meta.next;
+	*pending = MAX(meta.pending, *first);
+	k_mutex_unlock(&results_mutex);
+}
+
+int nat_results_uploaded(u32_t last)
+{
+	ssize_t len;
+	struct results_meta new_meta;
+
+	if (!initialized) {
+		return -ENODEV;
+	}
+
+	k_mutex_lock(&results_mutex, K_FOREVER);
+
+	if (last < meta.pending || last >= meta.next) {
+		k_mutex_unlock(&results_mutex);
+		return 0;
+	}
+
+	new_meta = meta;
+	new_meta.pending = last + 1;
+
+	len = nvs_write(&fs, META_ID, &new_meta, sizeof(new_meta));
+	if (len >= 0) {
+		meta = new_meta;
+	}
+
+	k_mutex_unlock(&results_mutex);
+
+	return len < 0 ? len : 0;
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+#ifndef NAT_RESULTS_H_
+#define NAT_RESULTS_H_
+
+#include <zephyr.h>
+
+#define NAT_RESULT_OPERATOR_SIZE 8
+
+/* Summary of one completed timeout measurement, stored in flash as is */
+struct nat_result {
+	/* Assigned when stored, increments with every result */
+	u32_t id;
+	/* Test type, see enum test_type */
+	u8_t type;
+	/* System mode, see enum lte_lc_system_mode */
+	u8_t rat;
+	u16_t probe_count;
+	char operator[NAT_RESULT_OPERATOR_SIZE];
+	u32_t cell_id;
+	/* Resulting timeout and the final search bracket in seconds */
+	s32_t timeout;
+	s32_t lower;
+	s32_t upper;
+	/* Time spent waiting for replies in seconds */
+	u32_t total_wait_s;
+	/* Probes repeated because the link was lost */
+	u16_t contaminated;
+	u16_t reserved;
+};
+
+#if defined(CONFIG_NAT_TEST_RESULTS)
+
+/**
+ * @brief Function for initializing the result store
+ *
+ * @return 0 on success, otherwise a negative error code.
+ */
+int nat_results_init(void);
+
+/**
+ * @brief Function to store a result
+ *
+ * The oldest result is overwritten once CONFIG_NAT_TEST_RESULTS_MAX
+ * results are stored.
+ *
+ * @param result Result to store, its id is assigned
+ *
+ * @return 0 on success, otherwise a negative error code.
+ */
+int nat_results_store(struct nat_result *result);
+
+/**
+ * @brief Function to read a stored result
+ *
+ * @param id Result id
+ * @param result Output
+ *
+ * @return 0 on success, -ENOENT if the result is no longer stored.
+ */
+int nat_results_read(u32_t id, struct nat_result *result);
+
+/**
+ * @brief Function to get the ids of the stored results
+ *
+ * @param first Id of the oldest stored result
+ * @param next Id the next result will get
+ * @param pending Id of the oldest result not uploaded yet
+ */
+void nat_results_range(u32_t *first, u32_t *next, u32_t *pending);
+
+/**
+ * @brief Function to mark results as uploaded
+ *
+ * @param last Id of the last result acknowledged by the server
+ *
+ * @return 0 on success, otherwise a negative error code.
+ */
+int nat_results_uploaded(u32_t last);
+
+#else
+
+static inline int nat_results_init(void)
+{
+	return 0;
+}
+
+static inline int nat_results_store(struct nat_result *result)
+{
+	return -ENOTSUP;
+}
+
+#endif /* CONFIG_NAT_TEST_RESULTS */
+
+#endif /* NAT_RESULTS_H_ */
@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+#include <zephyr.h>
+#include <logging/log.h>
+#include <net/socket.h>
+
+#include "nat_test.h"
+#include "nat_sched.h"
+
+LOG_MODULE_REGISTER(nat_sched, CONFIG_NAT_TEST_LOG_LEVEL);
+
+static void heap_swap(struct nat_sched *sched, size_t a, size_t b)
+{
+	struct nat_probe *tmp = sched->timers[a];
+
+	sched->timers[a] = sched->timers[b];
+	sched->timers[b] = tmp;
+	sched->timers[a]->heap_index = a;
+	sched->timers[b]->heap_index = b;
+}
+
+static void heap_up(struct nat_sched *sched, size_t index)
+{
+	while (index > 0) {
+		size_t parent = (index - 1) / 2;
+
+		if (sched->timers[parent]->deadline_ms <=
+		    sched->timers[index]->deadline_ms) {
+			break;
+		}
+
+		heap_swap(sched, parent, index);
+		index = parent;
+	}
+}
+
+static void heap_down(struct nat_sched *sched, size_t index)
+{
+	while (true) {
+		size_t left = 2 * index + 1;
+		size_t right = left + 1;
+		size_t smallest = index;
+
+		if (left < sched->timer_count &&
+		    sched->timers[left]->deadline_ms <
+			    sched->timers[smallest]->deadline_ms) {
+			smallest = left;
+		}
+		if (right < sched->timer_count &&
+		    sched->timers[right]->deadline_ms <
+			    sched->timers[smallest]->deadline_ms) {
+			smallest = right;
+		}
+		if (smallest == index) {
+			break;
+		}
+
+		heap_swap(sched, index, smallest);
+		index = smallest;
+	}
+}
+
+void nat_sched_init(struct nat_sched *sched)
+{
+	memset(sched, 0, sizeof(*sched));
+}
+
+int nat_sched_add(struct nat_sched *sched, struct nat_probe *probe,
+		  const struct nat_probe_ops *ops)
+{
+	if (sched->probe_count >= ARRAY_SIZE(sched->probes)) {
+		return -ENOMEM;
+	}
+
+	probe->ops = ops;
+	probe->fd = -1;
+	probe->deadline_ms = 0;
+	probe->heap_index = -1;
+
+	sched->probes[sched->probe_count++] = probe;
+
+	return 0;
+}
+
+void nat_sched_remove(struct nat_sched *sched, struct nat_probe *probe)
+{
+	nat_sched_deadline_clear(sched, probe);
+
+	for (size_t i = 0; i < sched->probe_count; i++) {
+		if (sched->probes[i] == probe) {
+			sched->probes[i] = sched->probes[--sched->probe_count];
+			break;
+		}
+	}
+}
+
+void nat_sched_deadline_set(struct nat_sched *sched, struct nat_probe *probe,
+			    s64_t deadline_ms)
+{
+	probe->deadline_ms = deadline_ms;
+
+	if (probe->heap_index < 0) {
+		probe->heap_index = sched->timer_count;
+		sched->timers[sched->timer_count++] = probe;
+	}
+
+	heap_up(sched, probe->heap_index);
+	heap_down(sched, probe->heap_index);
+}
+
+void nat_sched_deadline_clear(struct nat_sched *sched,
+			      struct nat_probe *probe)
+{
+	size_t index;
+	size_t last;
+
+	if (probe->heap_index < 0) {
+		return;
+	}
+
+	index = probe->heap_index;
+	last = --sched->timer_count;
+	probe->heap_index = -1;
+
+	if (index == last) {
+		return;
+	}
+
+	sched->timers[index] = sched->timers[last];
+	sched->timers[index]->heap_index = index;
+	heap_up(sched, index);
+	heap_down(sched, sched->timers[index]->heap_index);
+}
+
+static int next_wait_ms(struct nat_sched *sched, int max_wait_ms)
+{
+	s64_t wait_ms;
+
+	if (sched->timer_count == 0) {
+		return max_wait_ms;
+	}
+
+	wait_ms = sched->timers[0]->deadline_ms - k_uptime_get();
+	if (wait_ms < 0) {
+		return 0;
+	}
+
+	return MIN(wait_ms, max_wait_ms);
+}
+
+int nat_sched_run(struct nat_sched *sched, atomic_t *state, int max_wait_ms)
+{
+	int err;
+	int wait_ms;
+	size_t nfds;
+	s64_t now;
+	struct pollfd fds[CONFIG_NAT_TEST_MAX_PROBES];
+	struct nat_probe *fd_probes[CONFIG_NAT_TEST_MAX_PROBES];
+
+	while (sched->probe_count > 0) {
+		if (atomic_get(state) == ABORT) {
+			return -1;
+		}
+
+		nfds = 0;
+		for (size_t i = 0; i < sched->probe_count; i++) {
+			if (sched->probes[i]->fd < 0) {
+				continue;
+			}
+
+			fds[nfds].fd = sched->probes[i]->fd;
+			fds[nfds].events = POLLIN;
+			fds[nfds].revents = 0;
+			fd_probes[nfds++] = sched->probes[i];
+		}
+
+		wait_ms = next_wait_ms(sched, max_wait_ms);
+
+		if (nfds == 0) {
+			k_sleep(K_MSEC(wait_ms));
+			err = 0;
+		} else {
+			err = poll(fds, nfds, wait_ms);
+			if (err < 0) {
+				LOG_ERR("poll, error: %d", errno);
+
+				/* Let every probe handle it as a failed
+				 * socket.
+				 */
+				for (size_t i = 0; i < nfds; i++) {
+					fds[i].revents = POLLERR;
+				}
+			}
+		}
+
+		for (size_t i = 0; i < nfds && err != 0; i++) {
+			/* An earlier handler may have closed the socket */
+			if (fds[i].revents == 0 ||
+			    fd_probes[i]->fd != fds[i].fd) {
+				continue;
+			}
+
+			fd_probes[i]->ops->on_readable(fd_probes[i],
+						       fds[i].revents);
+		}
+
+		now = k_uptime_get();
+		while (sched->timer_count > 0 &&
+		       sched->timers[0]->deadline_ms <= now) {
+			struct nat_probe *probe = sched->timers[0];
+
+			nat_sched_deadline_clear(sched, probe);
+			probe->ops->on_deadline(probe);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+#ifndef NAT_SCHED_H_
+#define NAT_SCHED_H_
+
+#include <zephyr.h>
+
+struct nat_probe;
+
+struct nat_probe_ops {
+	/**
+	 * @brief Called when the probe socket is readable or has failed
+	 *
+	 * @param probe Probe owning the socket
+	 * @param revents Events reported by poll()
+	 */
+	void (*on_readable)(struct nat_probe *probe, short revents);
+
+	/**
+	 * @brief Called when the probe deadline has expired
+	 *
+	 * The deadline is cleared before the call, so the handler only needs
+	 * to set a new one if it wants to be called again.
+	 *
+	 * @param probe Probe whose deadline expired
+	 */
+	void (*on_deadline)(struct nat_probe *probe);
+};
+
+/**
+ * @brief Scheduler part of a probe
+ *
+ * Embedded in the owner's probe state, which is retrieved with
+ * CONTAINER_OF() in the callbacks.
+ */
+struct nat_probe {
+	const struct nat_probe_ops *ops;
+	/* Socket polled for the probe, -1 if none */
+	int fd;
+	/* Uptime in milliseconds at which on_deadline is called */
+	s64_t deadline_ms;
+	/* Position in the timer heap, -1 if no deadline is set */
+	int heap_index;
+};
+
+struct nat_sched {
+	struct nat_probe *probes[CONFIG_NAT_TEST_MAX_PROBES];
+	size_t probe_count;
+	/* Min-heap of probes ordered by deadline */
+	struct nat_probe *timers[CONFIG_NAT_TEST_MAX_PROBES];
+	size_t timer_count;
+};
+
+/**
+ * @brief Function to initialize a scheduler without probes
+ */
+void nat_sched_init(struct nat_sched *sched);
+
+/**
+ * @brief Function to add a probe to the scheduler
+ *
+ * The probe starts without socket and deadline.
+ *
+ * @return 0 on success, -ENOMEM if the maximum number of probes is reached.
+ */
+int nat_sched_add(struct nat_sched *sched, struct nat_probe *probe,
+		  const struct nat_probe_ops *ops);
+
+/**
+ * @brief Function to remove a probe from the scheduler
+ *
+ * The probe socket is not closed.
+ */
+void nat_sched_remove(struct nat_sched *sched, struct nat_probe *probe);
+
+/**
+ * @brief Function to set the deadline of a probe
+ *
+ * @param deadline_ms Uptime in milliseconds, replaces any earlier deadline
+ */
+void nat_sched_deadline_set(struct nat_sched *sched, struct nat_probe *probe,
+			    s64_t deadline_ms);
+
+/**
+ * @brief Function to clear the deadline of a probe
+ */
+void nat_sched_deadline_clear(struct nat_sched *sched,
+			      struct nat_probe *probe);
+
+/**
+ * @brief Function to run the event loop until all probes are removed
+ *
+ * All probe sockets are multiplexed in one poll() call, which waits until
+ * the earliest deadline but never longer than max_wait_ms, so that abort
+ * requests are noticed.
+ *
+ * @param state Test state, the loop returns when it is set to ABORT
+ * @param max_wait_ms Maximum time to block in one iteration
+ *
+ * @return 0 when all probes are done, -1 if aborted.
+ */
+int nat_sched_run(struct nat_sched *sched, atomic_t *state, int max_wait_ms);
+
+#endif /* NAT_SCHED_H_ */
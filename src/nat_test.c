@@ -5,19 +5,32 @@
  */
 
 #include <zephyr.h>
-#include <cJSON.h>
-#include <cJSON_os.h>
+#include <logging/log.h>
 #include <modem/lte_lc.h>
 #include <modem/modem_info.h>
 #include <net/socket.h>
+#include <random/rand32.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "nat_test.h"
+#include "nat_at.h"
+#include "nat_energy.h"
+#include "nat_event.h"
+#include "nat_impair.h"
+#include "nat_json.h"
+#include "nat_prof.h"
+#include "nat_progress.h"
+#include "nat_recovery.h"
+#include "nat_results.h"
+#include "nat_sched.h"
+
+LOG_MODULE_REGISTER(nat_test, CONFIG_NAT_TEST_LOG_LEVEL);
 
 #define UDP_PORT 3050
 #define TCP_PORT 3051
-#define THREAD_STACK_SIZE 8192
+#define THREAD_STACK_SIZE CONFIG_NAT_TEST_THREAD_STACK_SIZE
 #define WAIT_TIME_S 3
 #define WAIT_LOG_THRESHOLD_MS (60 * S_TO_MS_MULT)
 #define TIMEOUT_TOL_S 10
@@ -25,7 +38,24 @@
 #define DEFAULT_TCP_INITIAL_TIMEOUT 300
 #define DEFAULT_UDP_TIMEOUT_MULTIPLIER 2
 #define DEFAULT_TCP_TIMEOUT_MULTIPLIER 1.5
-#define IP_STRINGS_COUNT 10
+#define IDENTITY_RESPONSE_SIZE 64
+#define NETWORK_RESPONSE_SIZE 128
+#define NETWORK_VALUE_SIZE 16
+#define DEFAULT_KEEPALIVE_VERIFY_CYCLES 3
+#define REBIND_MAX_RETRIES 3
+#define RECONNECT_MAX_RETRIES 3
+#define KEEPALIVE_PROBE_INTERVAL_S 10
+#define KEEPALIVE_PROBE_COUNT 3
+/* IPv4 and TCP headers without options */
+#define TCPIP_HEADER_SIZE 40
+#define RESULTS_BATCH_SIZE 4
+
+/* The keepalive mode sets the idle time per connection */
+#if defined(CONFIG_NAT_TEST_TCP_KEEPALIVE) && \
+	!(defined(TCP_KEEPIDLE) && defined(TCP_KEEPINTVL) && \
+	  defined(TCP_KEEPCNT))
+#error "CONFIG_NAT_TEST_TCP_KEEPALIVE needs TCP_KEEPIDLE, TCP_KEEPINTVL and TCP_KEEPCNT"
+#endif
 
 struct test_thread_timeout {
 	int timeout;
@@ -34,11 +64,96 @@ struct test_thread_timeout {
 	int upper;
 };
 
+struct keepalive_verify_result {
+	int interval;
+	int cycles;
+	int failures;
+	s64_t total_latency_ms;
+	s64_t max_latency_ms;
+	s64_t total_active_ms;
+};
+
+enum reply_match {
+	REPLY_MATCHED,
+	REPLY_STALE,
+	REPLY_DUPLICATE,
+	REPLY_UNMATCHED,
+};
+
+enum probe_phase {
+	PROBE_PHASE_SEARCH,
+	PROBE_PHASE_VERIFY,
+};
+
+enum probe_state {
+	PROBE_STATE_WAIT_LTE,
+	/* Socket kept open without traffic, rebind mode only */
+	PROBE_STATE_IDLE,
+	PROBE_STATE_WAIT_REPLY,
+	/* Connection kept alive by the TCP stack, keepalive mode only */
+	PROBE_STATE_WAIT_KEEPALIVE,
+	PROBE_STATE_DONE,
+};
+
+/* State machine of one probe, driven by the scheduler callbacks */
+struct test_probe {
+	struct nat_probe probe;
+	enum test_type type;
+	enum probe_phase phase;
+	enum probe_state state;
+	int port;
+	struct test_thread_timeout timeout_data;
+	bool using_binary_search;
+	/* Interval of the probe in flight */
+	int interval;
+	/* Random per test, sequence number per probe sent */
+	u32_t nonce;
+	u32_t seq;
+	/* Sequence number of the last matched reply, 0 if none */
+	u32_t matched_seq;
+	u32_t stale_replies;
+	u32_t duplicate_replies;
+	u32_t unmatched_replies;
+	/* unmatched_replies when the current interval started */
+	u32_t unmatched_at_start;
+	/* Mapping seen in the last reply on the current socket */
+	bool mapping_valid;
+	struct nat_json_mapping mapping;
+	u32_t mapping_changes;
+	int rebind_retries;
+	/* Consecutive connection failures without an outcome in between */
+	int reconnect_retries;
+	/* Server clock minus uptime, taken from the reply with the lowest
+	 * network round trip, where the path is most likely symmetric.
+	 */
+	bool offset_valid;
+	s64_t offset_ms;
+	s64_t offset_rtt_ms;
+	s64_t sent_ms;
+	/* Link epoch and uptime when the measurement of the current interval
+	 * started
+	 */
+	u32_t epoch;
+	s64_t measure_ms;
+	/* Totals for the result record */
+	u16_t probe_count;
+	u16_t contaminated;
+	s64_t wait_ms;
+	s64_t reply_deadline_ms;
+	s64_t active_start_ms;
+	s64_t start_ms;
+	/* Keep-alive verification */
+	int verify_index;
+	struct keepalive_verify_result verify;
+	int verify_best_interval;
+	s64_t verify_best_active_ms_per_hour;
+};
+
 struct test_thread_data {
 	atomic_t type;
 	atomic_t state;
+	atomic_t start_pending;
 	struct k_sem sem;
-	struct test_thread_timeout timeout_data;
 };
 
 struct test_thread {
@@ -50,134 +165,73 @@ struct test_thread {
 
 K_THREAD_STACK_DEFINE(nat_test_thread_stack_area, THREAD_STACK_SIZE);
 
+BUILD_ASSERT(CONFIG_NAT_TEST_MAX_PROBES >= 2, "UDP and TCP need two probes");
+
 static struct test_thread test_thread;
+static struct nat_sched sched;
+static struct test_probe test_probes[CONFIG_NAT_TEST_MAX_PROBES];
+/* Only used from the test thread, so all probes share the buffers */
+static char send_buf[BUF_SIZE];
+static char recv_buf[BUF_SIZE];
+static struct modem_param_info modem_params;
+static struct sockaddr_in server_addr;
+static bool server_addr_valid;
+static bool first_probe_sent;
+
+/* Fractions (in percent) of the found timeout used as keep-alive intervals */
+static const int default_keepalive_verify_fractions[] = { 90, 75, 50 };
+
+static const char *const test_type_names[] = {
+	[TEST_UDP] = "udp",
+	[TEST_TCP] = "tcp",
+	[TEST_UDP_AND_TCP] = "udp_and_tcp",
+	[TEST_UDP_REBIND] = "udp_rebind",
+	[TEST_TCP_KEEPALIVE] = "tcp_keepalive",
+};
 
 volatile int udp_initial_timeout;
 volatile int tcp_initial_timeout;
 volatile float udp_timeout_multiplier;
 volatile float tcp_timeout_multiplier;
+volatile bool keepalive_verify_enabled;
+volatile int keepalive_verify_cycles;
+volatile int keepalive_verify_fractions[KEEPALIVE_VERIFY_MAX_FRACTIONS];
 
 int get_test_state(void)
 {
 	return atomic_get(&test_thread.thread_data.state);
 }
 
-static int json_add_obj(cJSON *parent, const char *str, cJSON *item)
-{
-	cJSON_AddItemToObject(parent, str, item);
-
-	return 0;
-}
-
-static int json_add_str(cJSON *parent, const char *str, const char *item)
-{
-	cJSON *json_str;
-
-	json_str = cJSON_CreateString(item);
-	if (json_str == NULL) {
-		return -ENOMEM;
-	}
-
-	return json_add_obj(parent, str, json_str);
-}
-
-static int json_add_number(cJSON *parent, const char *str, double item)
+const char *nat_test_type_name(enum test_type type)
 {
-	cJSON *json_num;
-
-	json_num = cJSON_CreateNumber(item);
-	if (json_num == NULL) {
-		return -ENOMEM;
+	if (type < 0 || type >= ARRAY_SIZE(test_type_names)) {
+		return "unknown";
 	}
 
-	return json_add_obj(parent, str, json_num);
+	return test_type_names[type];
 }
 
-static int create_send_buffer(struct modem_param_info *const modem_params,
-			      char *buffer, int timeout_s)
+bool nat_test_verify_follows(enum test_type type, int timeout)
 {
-	int ret = 0;
-	cJSON *root_obj = cJSON_CreateObject();
-	cJSON *ip_obj;
-	const char *delim = " ";
-	const char *ip_strings[IP_STRINGS_COUNT];
-	int ip_count = 0;
-
-	if (root_obj == NULL) {
-		printk("Failed to create json root object\n");
-		return -ENOMEM;
-	}
-
-	char *token =
-		strtok(modem_params->network.ip_address.value_string, delim);
-	while (token != NULL) {
-		if (ip_count >= ARRAY_SIZE(ip_strings)) {
-			printk("More than %d addresses found. Remainder will not be added to json\n",
-			       IP_STRINGS_COUNT);
-			break;
-		}
-		ip_strings[ip_count] = token;
-		token = strtok(NULL, delim);
-		ip_count++;
-	}
-
-	ip_obj = cJSON_CreateStringArray(ip_strings, ip_count);
-	if (ip_obj == NULL) {
-		printk("Failed to create json ip object\n");
-		ret = -ENOMEM;
-		goto exit;
-	}
-
-	ret += json_add_obj(root_obj, "ip", ip_obj);
-	ret += json_add_str(
-		root_obj, "op",
-		modem_params->network.current_operator.value_string);
-	ret += json_add_number(root_obj, "cell_id",
-			       modem_params->network.cellid_dec);
-	ret += json_add_number(root_obj, "ue_mode",
-			       modem_params->network.ue_mode.value);
-	ret += json_add_number(root_obj, "lte_mode",
-			       modem_params->network.lte_mode.value);
-	ret += json_add_number(root_obj, "nbiot_mode",
-			       modem_params->network.nbiot_mode.value);
-	ret += json_add_str(root_obj, "iccid",
-			    modem_params->sim.iccid.value_string);
-	ret += json_add_str(root_obj, "imei",
-			    modem_params->device.imei.value_string);
-	ret += json_add_number(root_obj, "interval", timeout_s);
-
-	if (ret) {
-		printk("Failed to add json value\n");
-		ret = -ENOMEM;
-		goto exit;
-	}
-
-	char *root_obj_string = cJSON_Print(root_obj);
-
-	if (root_obj_string == NULL) {
-		printk("Failed to print json object\n");
-		ret = -1;
-		goto exit;
-	}
-
-	ret = strlen(root_obj_string);
-	memcpy(buffer, root_obj_string, ret);
-	cJSON_FreeString(root_obj_string);
-
-exit:
-	cJSON_Delete(root_obj);
-
-	return ret;
+	return keepalive_verify_enabled && timeout > 0 &&
+	       (type == TEST_UDP || type == TEST_TCP);
 }
 
-static int send_data(int client_fd, int timeout_s,
+static int send_data(int client_fd, enum test_type type, int timeout_s,
+		     u32_t seq, u32_t nonce,
 		     struct modem_param_info *const modem_params)
 {
 	int err;
-	char send_buf[BUF_SIZE] = { 0 };
 	int send_len;
+	struct nat_json_probe probe = {
+		.type = type,
+		.interval = timeout_s,
+		.seq = seq,
+		.nonce = nonce,
+	};
 
-	send_len = create_send_buffer(modem_params, send_buf, timeout_s);
+	send_len = nat_json_probe_encode(&probe, modem_params, send_buf,
+					 sizeof(send_buf));
 	if (send_len < 0) {
 		return -1;
 	}
@@ -185,120 +239,198 @@ static int send_data(int client_fd, int timeout_s,
 	/* send len + 1 for null terminated packet */
 	err = send(client_fd, send_buf, send_len + 1, 0);
 	if (err < 0) {
-		printk("Failed to send data, errno: %d\n", errno);
+		LOG_ERR("Failed to send data, errno: %d", errno);
 
 		return -ENOTCONN;
 	}
 
-	printk("Packet sent: %s\n", send_buf);
+	if (!first_probe_sent) {
+		first_probe_sent = true;
+		LOG_INF("First probe sent %d ms after boot",
+			(int)k_uptime_get());
+	}
+
+	LOG_HEXDUMP_DBG(send_buf, send_len, "Packet sent");
+	nat_event_emit(NAT_EVENT_PROBE_SENT, type, timeout_s, send_len);
+
 	return 0;
 }
 
-static int poll_and_read(int client_fd, int timeout_s, atomic_t *state)
+static int resolve_server(void)
 {
 	int err;
-	char recv_buf[BUF_SIZE] = { 0 };
-	size_t ret_len;
-	struct pollfd fds[] = { { .fd = client_fd, .events = POLLIN } };
-	s64_t start_time_ms = k_uptime_get();
-	s64_t per_log_poll_time_ms = 0;
-	s64_t total_poll_time_ms = 0;
-
-	while (1) {
-		if (atomic_get(state) == ABORT) {
-			return -1;
-		}
-
-		err = poll(fds, ARRAY_SIZE(fds), WAIT_TIME_S * S_TO_MS_MULT);
-		if (err < 0) {
-			printk("poll, error: %d", err);
-
-			return -ENOTCONN;
-		} else if (err == 0) {
-			int delta = k_uptime_delta(&start_time_ms);
-
-			per_log_poll_time_ms += delta;
-			total_poll_time_ms += delta;
-			if (total_poll_time_ms <=
-			    (timeout_s + TIMEOUT_TOL_S) * S_TO_MS_MULT) {
-				if (per_log_poll_time_ms >=
-				    WAIT_LOG_THRESHOLD_MS) {
-					printk("Elapsed time: %d of %d seconds (%d seconds tolerance)\n",
-					       (int)(total_poll_time_ms /
-						     S_TO_MS_MULT),
-					       timeout_s + TIMEOUT_TOL_S,
-					       TIMEOUT_TOL_S);
-					per_log_poll_time_ms = 0;
-				}
-
-				continue;
-			}
+	struct addrinfo *res;
+	struct addrinfo hints = {
+		.ai_family = AF_INET,
+	};
 
-			printk("No response from server\n");
-			return 0;
-		} else if ((fds[0].revents & POLLIN) == POLLIN) {
-			ret_len = recv(client_fd, recv_buf,
-				       sizeof(recv_buf) - 1, 0);
-			if (ret_len > 0 && ret_len < BUF_SIZE) {
-				recv_buf[ret_len] = 0;
-
-				if (strstr(recv_buf, "error") != NULL ||
-				    strstr(recv_buf, "Error") != NULL) {
-					printk("Response: %s\n", recv_buf);
-					return -1;
-				}
-
-				printk("Response: %s\n", recv_buf);
-				return 1;
-			}
-		}
+	err = getaddrinfo(SERVER_HOSTNAME, NULL, &hints, &res);
+	if (err) {
+		LOG_ERR("getaddrinfo() failed, err %d", errno);
+		return -1;
 	}
+
+	memcpy(&server_addr, res->ai_addr, sizeof(server_addr));
+	freeaddrinfo(res);
+	server_addr_valid = true;
+
+	return 0;
 }
 
 static int setup_connection(int *client_fd, enum test_type type, int port,
 			    atomic_t *state)
 {
 	int err;
-	struct addrinfo *res;
-	struct addrinfo hints = {
-		.ai_family = AF_INET,
-	};
 
-	if (type == TEST_UDP) {
+	if (type == TEST_UDP || type == TEST_UDP_REBIND) {
 		*client_fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-		if (client_fd <= 0) {
-			printk("socket() failed, errno: %d\n", errno);
+		if (*client_fd < 0) {
+			LOG_ERR("socket() failed, errno: %d", errno);
 			return -1;
 		}
-
-		hints.ai_socktype = SOCK_DGRAM;
-	} else if (type == TEST_TCP) {
+	} else if (type == TEST_TCP || type == TEST_TCP_KEEPALIVE) {
 		*client_fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-		if (client_fd <= 0) {
-			printk("socket() failed, errno: %d\n", errno);
+		if (*client_fd < 0) {
+			LOG_ERR("socket() failed, errno: %d", errno);
 			return -2;
 		}
-
-		hints.ai_socktype = SOCK_STREAM;
 	} else {
 		return -1;
 	}
 
-	err = getaddrinfo(SERVER_HOSTNAME, NULL, &hints, &res);
+	/* The server address is resolved once and reused for every
+	 * reconnect, so only the first connection pays for DNS.
+	 */
+	if (!server_addr_valid) {
+		err = resolve_server();
+		if (err) {
+			(void)close(*client_fd);
+			return -1;
+		}
+	}
+
+	server_addr.sin_port = htons(port);
+
+	err = connect(*client_fd, (struct sockaddr *)&server_addr,
+		      sizeof(server_addr));
 	if (err) {
-		printk("getaddrinfo() failed, err %d\n", errno);
+		LOG_ERR("connect failed, errno: %d", errno);
+		/* Resolve again on the next attempt in case the server moved */
+		server_addr_valid = false;
+		(void)close(*client_fd);
 		return -1;
 	}
 
-	((struct sockaddr_in *)res->ai_addr)->sin_port = htons(port);
+	LOG_INF("Connected to server");
+
+	return 0;
+}
+
+static int wait_for_lte(atomic_t *state)
+{
+	while (!is_lte_connected()) {
+		if (atomic_get(state) == ABORT) {
+			return -1;
+		}
+
+		(void)lte_connected_wait(K_SECONDS(WAIT_TIME_S));
+	}
+
+	return 0;
+}
+
+static void prefetch_identity(struct modem_param_info *const modem_params)
+{
+	char imei[IDENTITY_RESPONSE_SIZE];
+	char iccid[IDENTITY_RESPONSE_SIZE];
+	struct nat_at_cmd cmds[] = {
+		{ .cmd = "AT+CGSN=1", .buf = imei, .size = sizeof(imei) },
+		{ .cmd = "AT%XICCID", .buf = iccid, .size = sizeof(iccid) },
+	};
+
+	/* Identity does not depend on the network and can be read while the
+	 * modem is still attaching.
+	 */
+	(void)nat_at_batch(cmds, ARRAY_SIZE(cmds), NULL, NULL);
+
+	(void)nat_at_param_get(imei, "+CGSN", 0,
+			       modem_params->device.imei.value_string,
+			       sizeof(modem_params->device.imei.value_string));
+	(void)nat_at_param_get(iccid, "%XICCID", 0,
+			       modem_params->sim.iccid.value_string,
+			       sizeof(modem_params->sim.iccid.value_string));
+
+	LOG_INF("IMEI: %s, ICCID: %s",
+		log_strdup(modem_params->device.imei.value_string),
+		log_strdup(modem_params->sim.iccid.value_string));
+}
+
+/* Values that are missing from the response are left empty, so the probes
+ * never carry values from an earlier network.
+ */
+static void network_param_get(const char *rsp, const char *prefix, int index,
+			      char *buf, size_t size)
+{
+	int err = nat_at_param_get(rsp, prefix, index, buf, size);
+
+	if (err) {
+		LOG_WRN("%s parameter %d not found: %d", prefix, index, err);
+		buf[0] = '\0';
+	}
+}
+
+/* Reads the network parameters sent with every probe. Only these are
+ * queried, in one batch, instead of everything modem_info knows.
+ */
+static int fetch_network_params(struct modem_param_info *const modem_params)
+{
+	static char responses[5][NETWORK_RESPONSE_SIZE];
+	struct nat_at_cmd cmds[] = {
+		{ .cmd = "AT+CGDCONT?" },
+		{ .cmd = "AT+COPS?" },
+		{ .cmd = "AT+CEREG?" },
+		{ .cmd = "AT+CEMODE?" },
+		{ .cmd = "AT%XSYSTEMMODE?" },
+	};
+	struct network_param *network = &modem_params->network;
+	char value[NETWORK_VALUE_SIZE];
+	int err;
+
+	BUILD_ASSERT(ARRAY_SIZE(cmds) == ARRAY_SIZE(responses),
+		     "One response buffer per command");
+
+	for (size_t i = 0; i < ARRAY_SIZE(cmds); i++) {
+		cmds[i].buf = responses[i];
+		cmds[i].size = sizeof(responses[i]);
+	}
 
-	err = connect(*client_fd, res->ai_addr, sizeof(struct sockaddr_in));
+	err = nat_at_batch(cmds, ARRAY_SIZE(cmds), NULL, NULL);
 	if (err) {
-		printk("connect failed, errno: %d\n\r", errno);
-		return -1;
+		return err;
 	}
 
-	printk("Connected to server\n");
+	/* Address of the default PDP context */
+	network_param_get(responses[0], "+CGDCONT", 3,
+			  network->ip_address.value_string,
+			  sizeof(network->ip_address.value_string));
+	network_param_get(responses[1], "+COPS", 2,
+			  network->current_operator.value_string,
+			  sizeof(network->current_operator.value_string));
+	network_param_get(responses[2], "+CEREG", 3, value, sizeof(value));
+	network->cellid_dec = strtoul(value, NULL, 16);
+	network_param_get(responses[3], "+CEMODE", 0, value, sizeof(value));
+	network->ue_mode.value = atoi(value);
+	network_param_get(responses[4], "%XSYSTEMMODE", 0, value,
+			  sizeof(value));
+	network->lte_mode.value = atoi(value);
+	network_param_get(responses[4], "%XSYSTEMMODE", 1, value,
+			  sizeof(value));
+	network->nbiot_mode.value = atoi(value);
+
+	LOG_DBG("IP %s, operator %s, cell %d",
+		log_strdup(network->ip_address.value_string),
+		log_strdup(network->current_operator.value_string),
+		(int)network->cellid_dec);
 
 	return 0;
 }
@@ -332,11 +464,13 @@ static void init_values(struct test_thread_timeout *timeout_data,
 
 	switch (type) {
 	case TEST_UDP:
+	case TEST_UDP_REBIND:
 		timeout_data->timeout = udp_initial_timeout;
 		timeout_data->multiplier = udp_timeout_multiplier;
 		*port = UDP_PORT;
 		break;
 	case TEST_TCP:
+	case TEST_TCP_KEEPALIVE:
 		timeout_data->timeout = tcp_initial_timeout;
 		timeout_data->multiplier = tcp_timeout_multiplier;
 		*port = TCP_PORT;
@@ -347,214 +481,1447 @@ static void init_values(struct test_thread_timeout *timeout_data,
 	}
 }
 
-static void nat_test_run_single(enum test_type type,
-				struct test_thread_timeout *timeout_data,
-				atomic_t *state)
+static int probe_interval(struct test_probe *tp)
 {
-	int err;
-	int client_fd;
-	bool finished = false;
-	bool using_binary_search = false;
-	int port = 0;
-	enum lte_lc_nw_reg_status network_status = get_network_status();
-	struct modem_param_info modem_params = { 0 };
-
-	if ((network_status != LTE_LC_NW_REG_REGISTERED_HOME) &&
-	    (network_status != LTE_LC_NW_REG_REGISTERED_ROAMING)) {
-		printk("LTE link not established.\nAborting test.\n");
-		return;
+	if (tp->phase == PROBE_PHASE_VERIFY) {
+		return tp->verify.interval;
 	}
 
-	init_values(timeout_data, type, &port);
+	return tp->timeout_data.timeout;
+}
 
-	err = setup_connection(&client_fd, type, port, state);
-	if (err < 0) {
-		return;
+/* Publishes the search state for the progress estimate */
+static void progress_publish(struct test_probe *tp)
+{
+	struct nat_progress_probe progress = {
+		.type = tp->type,
+		.verify_phase = tp->phase == PROBE_PHASE_VERIFY,
+		.binary_search = tp->using_binary_search,
+		.timeout = tp->timeout_data.timeout,
+		.multiplier = tp->timeout_data.multiplier,
+		.lower = tp->timeout_data.lower,
+		.upper = tp->timeout_data.upper,
+		.verify_enabled = keepalive_verify_enabled &&
+				  (tp->type == TEST_UDP ||
+				   tp->type == TEST_TCP),
+		.verify_index = tp->verify_index,
+		.verify_cycles_done = tp->verify.cycles,
+		.probe_count = tp->probe_count,
+		.test_start_ms = (u32_t)tp->start_ms,
+		.measure_start_ms = (u32_t)tp->measure_ms,
+	};
+
+	switch (tp->type) {
+	case TEST_UDP_REBIND:
+		/* Echoed at once, a mapping change shows the expiry */
+		break;
+	case TEST_TCP_KEEPALIVE:
+		progress.keep_cost_s =
+			KEEPALIVE_PROBE_INTERVAL_S * KEEPALIVE_PROBE_COUNT +
+			TIMEOUT_TOL_S;
+		progress.expire_cost_s =
+			KEEPALIVE_PROBE_INTERVAL_S * KEEPALIVE_PROBE_COUNT;
+		break;
+	default:
+		progress.expire_cost_s = TIMEOUT_TOL_S;
+		break;
 	}
 
-	err = modem_info_params_init(&modem_params);
-	if (err) {
-		printk("Modem info params could not be initialised: %d\n", err);
-		return;
+	nat_progress_update(tp - test_probes, &progress);
+}
+
+/* Called whenever the measurement of an interval starts */
+static void measure_start(struct test_probe *tp)
+{
+	tp->unmatched_at_start = tp->unmatched_replies;
+	progress_publish(tp);
+	nat_energy_probe_start(tp - test_probes, tp->type, probe_interval(tp));
+}
+
+static void probe_finish(struct test_probe *tp)
+{
+	if (tp->probe.fd >= 0) {
+		(void)close(tp->probe.fd);
+		tp->probe.fd = -1;
 	}
 
-	err = modem_info_params_get(&modem_params);
-	if (err < 0) {
-		printk("Unable to obtain modem parameters: %d\n", err);
-		return;
+	tp->state = PROBE_STATE_DONE;
+	nat_sched_remove(&sched, &tp->probe);
+	nat_progress_remove(tp - test_probes);
+	nat_energy_probe_stop(tp - test_probes);
+	nat_energy_report(tp->type);
+}
+
+static void probe_reconnect(struct test_probe *tp)
+{
+	if (tp->probe.fd >= 0) {
+		(void)close(tp->probe.fd);
+		tp->probe.fd = -1;
 	}
 
-	while (!finished) {
-		if (atomic_get(state) == ABORT) {
-			goto abort;
-		}
+	tp->state = PROBE_STATE_WAIT_LTE;
+	tp->mapping_valid = false;
+	nat_sched_deadline_set(&sched, &tp->probe, k_uptime_get());
+}
 
-		err = send_data(client_fd, timeout_data->timeout,
-				&modem_params);
-		if (err < 0) {
-			if (err == -ENOTCONN) {
-				goto reconnect;
-			}
-			goto abort;
-		}
+/* Keep the socket silent for the interval under test, rebind mode only */
+static void probe_idle(struct test_probe *tp)
+{
+	tp->epoch = nat_recovery_epoch_get();
+	tp->measure_ms = k_uptime_get();
+	tp->state = PROBE_STATE_IDLE;
+	nat_sched_deadline_set(&sched, &tp->probe,
+			       k_uptime_get() + (s64_t)probe_interval(tp) *
+							S_TO_MS_MULT);
+	measure_start(tp);
+}
 
-		err = poll_and_read(client_fd, timeout_data->timeout, state);
-		if (err < 0) {
-			if (err == -ENOTCONN) {
-				goto reconnect;
-			}
-			goto abort;
-		} else if (err == 0) {
-			using_binary_search = true;
-			finished =
-				get_timeout_binary_search(timeout_data, true);
-			goto reconnect;
-		} else if (err > 0 && using_binary_search) {
-			finished =
-				get_timeout_binary_search(timeout_data, false);
-		}
+/* Called once the outcome of a probe is known */
+static void probe_end(void)
+{
+	nat_prof_probe_end();
+	nat_json_arena_reset();
+}
 
-		if (!using_binary_search) {
-			timeout_data->lower = timeout_data->timeout;
-			timeout_data->timeout *= timeout_data->multiplier;
-		}
+static void probe_outcome(struct test_probe *tp, int result);
 
-		continue;
+static void probe_send(struct test_probe *tp)
+{
+	int err;
 
-	reconnect:
-		network_status = get_network_status();
+	/* In rebind mode the measurement started with the idle period */
+	if (tp->state != PROBE_STATE_IDLE) {
+		tp->epoch = nat_recovery_epoch_get();
+		tp->measure_ms = k_uptime_get();
+		measure_start(tp);
+	}
 
-		/* Wait for LTE link to be established or for test to be aborted */
-		while (true) {
-			if (atomic_get(state) == ABORT) {
-				goto abort;
-			} else if ((network_status ==
-				    LTE_LC_NW_REG_REGISTERED_HOME) ||
-				   (network_status ==
-				    LTE_LC_NW_REG_REGISTERED_ROAMING)) {
-				break;
-			}
-			k_sleep(K_SECONDS(WAIT_TIME_S));
-			network_status = get_network_status();
-		}
+	tp->seq++;
+	tp->interval = probe_interval(tp);
+	tp->sent_ms = k_uptime_get();
+	tp->active_start_ms = get_rrc_connected_time_ms();
 
-		close(client_fd);
+	nat_prof_probe_begin();
 
-		err = setup_connection(&client_fd, type, port, state);
-		if (err < 0) {
-			return;
-		}
+	if (nat_impair_probe_send(tp - test_probes)) {
+		/* Lost on the way, wait for the reply as if it was sent */
+		err = 0;
+	} else {
+		err = send_data(tp->probe.fd, tp->type, tp->interval, tp->seq,
+				tp->nonce, &modem_params);
+	}
+	if (err == -ENOTCONN) {
+		/* A failed attempt, like a connection lost while waiting */
+		probe_outcome(tp, err);
+		return;
+	} else if (err < 0) {
+		probe_end();
+		probe_finish(tp);
+		return;
+	}
+
+	tp->state = PROBE_STATE_WAIT_REPLY;
+	tp->reply_deadline_ms = tp->sent_ms + TIMEOUT_TOL_S * S_TO_MS_MULT;
+	if (tp->type != TEST_UDP_REBIND) {
+		/* The server holds the reply for the interval */
+		tp->reply_deadline_ms +=
+			(s64_t)tp->interval * S_TO_MS_MULT;
 	}
+	nat_sched_deadline_set(&sched, &tp->probe,
+			       MIN(tp->sent_ms + WAIT_LOG_THRESHOLD_MS,
+				   tp->reply_deadline_ms));
+}
 
-	printk("Finished NAT timeout measurements\nMax keep-alive time: %d seconds\n",
-	       timeout_data->timeout);
+static int keepalive_options_set(int fd, int idle)
+{
+#if defined(CONFIG_NAT_TEST_TCP_KEEPALIVE)
+	int err;
+	int enable = 1;
+	int probe_interval_s = KEEPALIVE_PROBE_INTERVAL_S;
+	int probe_count = KEEPALIVE_PROBE_COUNT;
+
+	err = setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &enable, sizeof(enable));
+	if (!err) {
+		err = setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle,
+				 sizeof(idle));
+	}
+	if (!err) {
+		err = setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL,
+				 &probe_interval_s, sizeof(probe_interval_s));
+	}
+	if (!err) {
+		err = setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &probe_count,
+				 sizeof(probe_count));
+	}
 
-abort:
-	(void)close(client_fd);
+	return err;
+#else
+	/* Checked by nat_test_start() already */
+	errno = ENOTSUP;
+	return -1;
+#endif
 }
 
-static void nat_test_run_both(struct test_thread_data *thread_data)
+/* Let the TCP stack keep the connection alive for the interval under test
+ * without any application data. If the NAT dropped the mapping, the first
+ * keepalive gets no answer or an RST and the connection fails.
+ */
+static void keepalive_start(struct test_probe *tp)
 {
-	nat_test_run_single(TEST_UDP, &thread_data->timeout_data,
-			    &thread_data->state);
+	int err;
 
-	if (atomic_get(&thread_data->state) != ABORT) {
-		nat_test_run_single(TEST_TCP, &thread_data->timeout_data,
-				    &thread_data->state);
+	tp->interval = probe_interval(tp);
+
+	err = keepalive_options_set(tp->probe.fd, tp->interval);
+	if (err) {
+		LOG_ERR("TCP keepalive not supported, errno: %d", errno);
+		probe_finish(tp);
+		return;
 	}
+
+	nat_prof_probe_begin();
+
+	tp->epoch = nat_recovery_epoch_get();
+	tp->sent_ms = k_uptime_get();
+	tp->measure_ms = tp->sent_ms;
+	tp->active_start_ms = get_rrc_connected_time_ms();
+	tp->state = PROBE_STATE_WAIT_KEEPALIVE;
+	measure_start(tp);
+
+	/* The connection survived if it is still up after the first
+	 * keepalive and all its retransmissions.
+	 */
+	tp->reply_deadline_ms =
+		tp->sent_ms +
+		(s64_t)(tp->interval +
+			KEEPALIVE_PROBE_INTERVAL_S * KEEPALIVE_PROBE_COUNT +
+			TIMEOUT_TOL_S) *
+			S_TO_MS_MULT;
+	nat_sched_deadline_set(&sched, &tp->probe, tp->reply_deadline_ms);
+
+	nat_event_emit(NAT_EVENT_PROBE_SENT, tp->type, tp->interval, 0);
 }
 
-int nat_test_start(enum test_type type)
+static void verify_next_fraction(struct test_probe *tp);
+
+static void verify_report(struct test_probe *tp)
 {
-	switch (atomic_get(&test_thread.thread_data.state)) {
-	case RUNNING:
-	case ABORT:
-		return -1;
-	case IDLE:
-	default:
-		break;
+	struct keepalive_verify_result *result = &tp->verify;
+	s64_t active_ms_per_hour = 0;
+	s64_t avg_latency_ms = 0;
+	int successes = result->cycles - result->failures;
+
+	if (result->cycles > 0) {
+		active_ms_per_hour = (result->total_active_ms * 3600) /
+				     ((s64_t)result->cycles * result->interval);
+	}
+	if (successes > 0) {
+		avg_latency_ms = result->total_latency_ms / successes;
 	}
 
-	atomic_set(&test_thread.thread_data.type, type);
-	k_sem_give(&test_thread.thread_data.sem);
+	LOG_INF("Interval %d s: %d/%d cycles failed, latency avg %d ms max %d ms, modem active %d ms/h",
+		result->interval, result->failures, result->cycles,
+		(int)avg_latency_ms, (int)result->max_latency_ms,
+		(int)active_ms_per_hour);
 
-	return 0;
+	if (result->failures > 0 || result->cycles == 0) {
+		return;
+	}
+
+	if (tp->verify_best_interval == 0 ||
+	    active_ms_per_hour < tp->verify_best_active_ms_per_hour) {
+		tp->verify_best_interval = result->interval;
+		tp->verify_best_active_ms_per_hour = active_ms_per_hour;
+	}
 }
 
-int nat_test_stop(void)
+static void verify_finish(struct test_probe *tp)
 {
-	switch (atomic_get(&test_thread.thread_data.state)) {
-	case RUNNING:
-		atomic_set(&test_thread.thread_data.state, ABORT);
-	case ABORT:
-		/* Give test thread enough time to detect abort request */
-		for (int i = 0; i < WAIT_TIME_S * 2; i++) {
-			if (atomic_get(&test_thread.thread_data.state) ==
-			    IDLE) {
-				return 0;
-			}
-			k_sleep(K_SECONDS(1));
-		}
-		return -1;
-	case IDLE:
-	default:
-		break;
+	if (tp->verify_best_interval == 0) {
+		LOG_WRN("No verified keep-alive interval without failures");
+	} else {
+		LOG_INF("Recommended keep-alive interval: %d seconds",
+			tp->verify_best_interval);
+		nat_event_emit(NAT_EVENT_VERIFY_RESULT, tp->type,
+			       tp->verify_best_interval,
+			       (int)tp->verify_best_active_ms_per_hour);
 	}
 
-	return 0;
+	probe_finish(tp);
 }
 
-static void nat_test_thread_entry_point(void *param, void *unused,
-					void *unused2)
+static void verify_start(struct test_probe *tp)
 {
-	struct test_thread_data *thread_data = (struct test_thread_data *)param;
+	LOG_INF("Verifying keep-alive intervals derived from %d seconds",
+		tp->timeout_data.timeout);
 
-	atomic_set(&thread_data->state, IDLE);
+	tp->phase = PROBE_PHASE_VERIFY;
+	tp->verify_index = -1;
+	tp->verify_best_interval = 0;
+	tp->verify_best_active_ms_per_hour = 0;
 
-	while (true) {
-		k_sem_take(&thread_data->sem, K_FOREVER);
+	verify_next_fraction(tp);
+}
 
-		atomic_set(&thread_data->state, RUNNING);
+static void verify_next_fraction(struct test_probe *tp)
+{
+	int fraction;
+	int interval;
 
-		printk("Test started\n");
-		switch (atomic_get(&thread_data->type)) {
-		case TEST_UDP:
-		case TEST_TCP:
-			nat_test_run_single(thread_data->type,
-					    &thread_data->timeout_data,
-					    &thread_data->state);
-			break;
-		case TEST_UDP_AND_TCP:
-			nat_test_run_both(thread_data);
+	if (tp->verify_index >= 0) {
+		verify_report(tp);
+	}
+
+	while (++tp->verify_index < KEEPALIVE_VERIFY_MAX_FRACTIONS) {
+		fraction = keepalive_verify_fractions[tp->verify_index];
+		if (fraction <= 0) {
 			break;
-		default:
-			printk("Thread with invalid type started");
-			return;
 		}
-		atomic_set(&thread_data->state, IDLE);
-		printk("Test idle\n");
+
+		interval = (tp->timeout_data.timeout * fraction) / 100;
+		if (interval <= 0) {
+			continue;
+		}
+
+		memset(&tp->verify, 0, sizeof(tp->verify));
+		tp->verify.interval = interval;
+
+		LOG_INF("Verifying %d%% of timeout: %d seconds, %d cycles",
+			fraction, interval, keepalive_verify_cycles);
+
+		/* All cycles of one interval share a fresh socket, so every
+		 * reply must arrive through the mapping that was refreshed
+		 * by the previous keep-alive.
+		 */
+		probe_reconnect(tp);
+		return;
 	}
+
+	verify_finish(tp);
 }
 
-static void prepare_and_start_thread(struct test_thread *thread)
+static void verify_outcome(struct test_probe *tp, int result)
 {
-	k_sem_init(&thread->thread_data.sem, 0, 1);
-	thread->stack_area = nat_test_thread_stack_area;
-	atomic_set(&thread->thread_data.state, UNINITIALIZED);
+	struct keepalive_verify_result *verify = &tp->verify;
+	s64_t latency_ms;
+
+	verify->cycles++;
+	verify->total_active_ms +=
+		get_rrc_connected_time_ms() - tp->active_start_ms;
+
+	if (result <= 0) {
+		/* The mapping is gone, the remaining cycles would only
+		 * measure a fresh one.
+		 */
+		verify->failures++;
+		verify_next_fraction(tp);
+		return;
+	}
 
-	thread->tid =
-		k_thread_create(&thread->thread, thread->stack_area,
-				THREAD_STACK_SIZE, nat_test_thread_entry_point,
-				(void *)&thread->thread_data, NULL, NULL,
-				THREAD_PRIORITY, 0, K_NO_WAIT);
+	latency_ms = k_uptime_get() - tp->sent_ms -
+		     (s64_t)verify->interval * S_TO_MS_MULT;
+	if (latency_ms < 0) {
+		latency_ms = 0;
+	}
+
+	verify->total_latency_ms += latency_ms;
+	if (latency_ms > verify->max_latency_ms) {
+		verify->max_latency_ms = latency_ms;
+	}
+
+	if (verify->cycles >= keepalive_verify_cycles) {
+		verify_next_fraction(tp);
+		return;
+	}
+
+	probe_send(tp);
 }
 
-void nat_test_init(void)
+/* Compares the traffic of TCP keepalives with application probes at the
+ * found interval. Both need one radio wake-up per keep-alive, so the
+ * difference is in the bytes sent and received while the radio is on.
+ */
+/* Radio time is what a keep-alive costs, its bytes hardly matter. Both a
+ * keepalive and an application probe wake the radio once per interval, so
+ * the measured radio time can be compared with the energy curve of a TCP
+ * test at the same interval.
+ */
+static void keepalive_airtime_report(struct test_probe *tp)
+{
+	struct nat_energy_point points[CONFIG_NAT_TEST_ENERGY_POINTS];
+	size_t count = nat_energy_curve_get(tp->type, points,
+					    ARRAY_SIZE(points));
+
+	for (size_t i = 0; i < count; i++) {
+		if (points[i].interval != tp->timeout_data.timeout ||
+		    points[i].kept == 0) {
+			continue;
+		}
+
+		LOG_INF("Per keep-alive: radio on %d ms, %d.%02d mAh/day at %d s",
+			points[i].connected_ms, points[i].uah_per_day / 1000,
+			(points[i].uah_per_day % 1000) / 10,
+			points[i].interval);
+		return;
+	}
+}
+
+static void keepalive_report(struct test_probe *tp)
+{
+	int payload_len;
+	int keepalive_bytes;
+	int probe_bytes;
+	int per_hour;
+	struct nat_json_probe probe = {
+		.type = TEST_TCP,
+		.interval = tp->timeout_data.timeout,
+		.seq = tp->seq,
+		.nonce = tp->nonce,
+	};
+
+	if (tp->timeout_data.timeout <= 0) {
+		return;
+	}
+
+	payload_len = nat_json_probe_encode(&probe, &modem_params, send_buf,
+					    sizeof(send_buf));
+	if (payload_len < 0) {
+		return;
+	}
+
+	/* Keepalive and its ACK carry no data */
+	keepalive_bytes = 2 * TCPIP_HEADER_SIZE;
+	/* Probe, echo of similar size and the ACKs of both */
+	probe_bytes = 2 * (payload_len + TCPIP_HEADER_SIZE) +
+		      2 * TCPIP_HEADER_SIZE;
+	per_hour = 3600 / tp->timeout_data.timeout;
+
+	LOG_INF("Per keep-alive: TCP keepalive %d bytes, application probe %d bytes",
+		keepalive_bytes, probe_bytes);
+	LOG_INF("Per hour: TCP keepalive %d bytes, application probe %d bytes",
+		keepalive_bytes * per_hour, probe_bytes * per_hour);
+
+	keepalive_airtime_report(tp);
+}
+
+static void result_store(struct test_probe *tp)
+{
+	struct nat_result result = {
+		.type = tp->type,
+		.rat = get_network_mode(),
+		.probe_count = tp->probe_count,
+		.cell_id = modem_params.network.cellid_dec,
+		.timeout = tp->timeout_data.timeout,
+		.lower = tp->timeout_data.lower,
+		.upper = tp->timeout_data.upper,
+		.total_wait_s = tp->wait_ms / S_TO_MS_MULT,
+		.contaminated = tp->contaminated,
+	};
+	int err;
+
+	strncpy(result.operator,
+		modem_params.network.current_operator.value_string,
+		sizeof(result.operator));
+
+	err = nat_results_store(&result);
+	if (err == 0) {
+		LOG_INF("Result %d stored", result.id);
+	}
+}
+
+static void search_finish(struct test_probe *tp)
+{
+	LOG_INF("Finished NAT timeout measurements");
+	if (tp->type == TEST_UDP_REBIND) {
+		LOG_INF("Max mapping lifetime: %d seconds, %u mapping changes",
+			tp->timeout_data.timeout, tp->mapping_changes);
+	} else if (tp->type == TEST_TCP_KEEPALIVE) {
+		LOG_INF("Max TCP keepalive idle time: %d seconds",
+			tp->timeout_data.timeout);
+		keepalive_report(tp);
+	} else {
+		LOG_INF("Max keep-alive time: %d seconds",
+			tp->timeout_data.timeout);
+	}
+	LOG_INF("Discarded replies: %u stale, %u duplicate, %u unmatched",
+		tp->stale_replies, tp->duplicate_replies,
+		tp->unmatched_replies);
+	nat_event_emit(NAT_EVENT_RESULT, tp->type, tp->timeout_data.timeout,
+		       tp->timeout_data.upper);
+	result_store(tp);
+
+	if (nat_test_verify_follows(tp->type, tp->timeout_data.timeout)) {
+		verify_start(tp);
+		return;
+	}
+
+	probe_finish(tp);
+}
+
+static void search_outcome(struct test_probe *tp, int result)
+{
+	struct test_thread_timeout *timeout_data = &tp->timeout_data;
+	bool finished = false;
+
+	if (result == -ENOTCONN &&
+	    ++tp->reconnect_retries <= RECONNECT_MAX_RETRIES) {
+		probe_reconnect(tp);
+		return;
+	} else if (result < 0) {
+		if (result == -ENOTCONN) {
+			LOG_ERR("Connection failed %d times in a row",
+				tp->reconnect_retries);
+		}
+		probe_finish(tp);
+		return;
+	}
+
+	tp->reconnect_retries = 0;
+
+	if (result == 0) {
+		tp->using_binary_search = true;
+		finished = get_timeout_binary_search(timeout_data, true);
+	} else if (tp->using_binary_search) {
+		finished = get_timeout_binary_search(timeout_data, false);
+	} else {
+		timeout_data->lower = timeout_data->timeout;
+		timeout_data->timeout *= timeout_data->multiplier;
+	}
+
+	if (finished) {
+		search_finish(tp);
+	} else if (tp->type == TEST_UDP_REBIND) {
+		probe_idle(tp);
+	} else if (tp->type == TEST_TCP_KEEPALIVE) {
+		/* The idle time of every interval starts at the handshake */
+		probe_reconnect(tp);
+	} else if (result == 0 && tp->type == TEST_TCP) {
+		probe_reconnect(tp);
+	} else {
+		/* A UDP socket survives an expired mapping, the next probe
+		 * simply creates a new one and late replies are discarded.
+		 */
+		probe_send(tp);
+	}
+}
+
+/* result: 1 on reply, 0 on timeout, -ENOTCONN if the connection failed and
+ * any other negative value if the test can not continue.
+ */
+static bool probe_contaminated(struct test_probe *tp, int result)
+{
+	if (nat_recovery_epoch_get() == tp->epoch) {
+		return false;
+	}
+
+	/* A reply that made it through is valid, unless the mapping itself
+	 * is measured, which a reattach may have replaced.
+	 */
+	return result == 0 || result == -ENOTCONN ||
+	       tp->type == TEST_UDP_REBIND;
+}
+
+/* A timeout after a discarded unmatched reply may have been that reply,
+ * so it can not move the search either.
+ */
+static bool probe_reply_unmatched(struct test_probe *tp, int result)
+{
+	return result == 0 && tp->unmatched_replies != tp->unmatched_at_start;
+}
+
+static void probe_outcome(struct test_probe *tp, int result)
+{
+	s64_t wait_ms = k_uptime_get() - tp->measure_ms;
+	bool link_lost = probe_contaminated(tp, result);
+	bool contaminated = link_lost || probe_reply_unmatched(tp, result);
+
+	probe_end();
+
+	tp->probe_count++;
+	tp->wait_ms += wait_ms;
+	nat_impair_probe_outcome(tp - test_probes, result, contaminated,
+				 wait_ms);
+
+	if (contaminated) {
+		tp->contaminated++;
+		/* Pause until the link is back and repeat the interval */
+		if (link_lost) {
+			LOG_WRN("LTE link lost during %d s probe, repeating it",
+				tp->interval);
+		} else {
+			LOG_WRN("Timeout of %d s probe after an unmatched reply, repeating it",
+				tp->interval);
+		}
+		nat_event_emit(NAT_EVENT_PROBE_CONTAMINATED, tp->type,
+			       tp->interval, 0);
+		probe_reconnect(tp);
+		return;
+	}
+
+	if (result >= 0) {
+		nat_energy_probe_outcome(tp - test_probes, result > 0);
+	}
+
+	if (tp->phase == PROBE_PHASE_VERIFY) {
+		verify_outcome(tp, result);
+	} else {
+		search_outcome(tp, result);
+	}
+}
+
+static enum reply_match match_reply(struct test_probe *tp,
+				    const struct nat_json_reply *reply)
+{
+	if (!reply->has_id) {
+		/* Plain text errors never carry an id, but still mean the
+		 * server can not handle the probe.
+		 */
+		if (reply->error) {
+			return REPLY_MATCHED;
+		}
+
+		/* Servers that do not echo the identification can only be
+		 * trusted when strict matching is disabled.
+		 */
+		return IS_ENABLED(CONFIG_NAT_TEST_STRICT_REPLY_MATCH) ?
+			       REPLY_UNMATCHED :
+			       REPLY_MATCHED;
+	}
+
+	if (reply->nonce != tp->nonce) {
+		return REPLY_UNMATCHED;
+	}
+
+	if (reply->seq == tp->seq && tp->matched_seq != tp->seq) {
+		return REPLY_MATCHED;
+	}
+
+	if (reply->seq != 0 && reply->seq == tp->matched_seq) {
+		return REPLY_DUPLICATE;
+	}
+
+	if (reply->seq < tp->seq) {
+		return REPLY_STALE;
+	}
+
+	return REPLY_UNMATCHED;
+}
+
+static void probe_discard_reply(struct test_probe *tp,
+				const struct nat_json_reply *reply,
+				enum reply_match match)
+{
+	switch (match) {
+	case REPLY_STALE:
+		tp->stale_replies++;
+		LOG_WRN("Stale reply %u discarded, waiting for %u", reply->seq,
+			tp->seq);
+		break;
+	case REPLY_DUPLICATE:
+		tp->duplicate_replies++;
+		LOG_WRN("Duplicate reply %u discarded", reply->seq);
+		break;
+	default:
+		tp->unmatched_replies++;
+		LOG_WRN("Unmatched %sreply discarded",
+			reply->error ? "error " : "");
+		break;
+	}
+
+	nat_event_emit(NAT_EVENT_PROBE_DISCARDED, tp->type, tp->interval,
+		       reply->seq);
+}
+
+/* Returns true if the mapping differs from the one of the previous reply */
+static bool probe_mapping_update(struct test_probe *tp,
+				 const struct nat_json_reply *reply)
+{
+	bool changed;
+
+	if (!reply->has_mapping) {
+		return false;
+	}
+
+	changed = tp->mapping_valid &&
+		  (tp->mapping.port != reply->mapping.port ||
+		   strcmp(tp->mapping.ip, reply->mapping.ip) != 0);
+
+	if (changed) {
+		tp->mapping_changes++;
+		LOG_INF("NAT mapping changed from %s:%d to %s:%d",
+			log_strdup(tp->mapping.ip), tp->mapping.port,
+			log_strdup(reply->mapping.ip), reply->mapping.port);
+		nat_event_emit(NAT_EVENT_MAPPING_CHANGED, tp->type,
+			       tp->interval, reply->mapping.port);
+	}
+
+	tp->mapping = reply->mapping;
+	tp->mapping_valid = true;
+
+	return changed;
+}
+
+/* In rebind mode a reply ends the idle period before its probe: the
+ * mapping survived the interval if the server saw the same public address
+ * as in the previous reply.
+ */
+static void rebind_reply(struct test_probe *tp,
+			 const struct nat_json_reply *reply)
+{
+	bool had_mapping = tp->mapping_valid;
+	bool changed;
+
+	tp->rebind_retries = 0;
+
+	if (!reply->has_mapping) {
+		LOG_ERR("Server does not echo the external mapping");
+		probe_outcome(tp, -1);
+		return;
+	}
+
+	changed = probe_mapping_update(tp, reply);
+
+	if (!had_mapping) {
+		/* First reply on this socket, only the reference mapping */
+		probe_end();
+		probe_idle(tp);
+		return;
+	}
+
+	probe_outcome(tp, changed ? 0 : 1);
+}
+
+static void rebind_timeout(struct test_probe *tp)
+{
+	probe_end();
+
+	/* The echo is immediate, so a missing one is packet loss and says
+	 * nothing about the mapping. Start over with a new reference.
+	 */
+	tp->mapping_valid = false;
+
+	if (++tp->rebind_retries > REBIND_MAX_RETRIES) {
+		LOG_ERR("No echo after %d retries", REBIND_MAX_RETRIES);
+		probe_finish(tp);
+		return;
+	}
+
+	probe_send(tp);
+}
+
+/* Splits the reply latency into uplink, server hold and downlink. Server
+ * and device clocks are not synchronized, so the offset between them is
+ * estimated NTP style from the fastest exchange seen so far.
+ */
+static void probe_latency_split(struct test_probe *tp,
+				const struct nat_json_reply *reply,
+				s64_t recv_ms)
+{
+	s64_t hold_ms = reply->send_ts - reply->recv_ts;
+	s64_t rtt_ms = (recv_ms - tp->sent_ms) - hold_ms;
+	s64_t uplink_ms;
+	s64_t downlink_ms;
+
+	if (hold_ms < 0 || rtt_ms < 0) {
+		LOG_WRN("Inconsistent server timestamps ignored");
+		return;
+	}
+
+	if (!tp->offset_valid || rtt_ms < tp->offset_rtt_ms) {
+		tp->offset_ms = ((reply->recv_ts - tp->sent_ms) +
+				 (reply->send_ts - recv_ms)) /
+				2;
+		tp->offset_rtt_ms = rtt_ms;
+		tp->offset_valid = true;
+	}
+
+	uplink_ms = reply->recv_ts - tp->offset_ms - tp->sent_ms;
+	downlink_ms = recv_ms - (reply->send_ts - tp->offset_ms);
+
+	LOG_INF("Latency: uplink %d ms, hold %d ms, downlink %d ms",
+		(int)uplink_ms, (int)hold_ms, (int)downlink_ms);
+}
+
+static void keepalive_on_readable(struct test_probe *tp, short revents)
+{
+	ssize_t ret_len = -1;
+	int sock_err = 0;
+	socklen_t len = sizeof(sock_err);
+
+	if (revents & POLLIN) {
+		ret_len = recv(tp->probe.fd, recv_buf, sizeof(recv_buf) - 1, 0);
+		if (ret_len > 0) {
+			LOG_WRN("Unexpected data on keepalive connection discarded");
+			return;
+		}
+	}
+
+	if (ret_len == 0) {
+		/* An orderly close comes from the server, e.g. on a restart,
+		 * and says nothing about the NAT
+		 */
+		LOG_WRN("Connection closed by the server after %d s",
+			(int)((k_uptime_get() - tp->sent_ms) / S_TO_MS_MULT));
+		nat_event_emit(NAT_EVENT_PROBE_ERROR, tp->type, tp->interval, 0);
+
+		nat_sched_deadline_clear(&sched, &tp->probe);
+		probe_outcome(tp, -ENOTCONN);
+		return;
+	}
+
+	if (ret_len < 0) {
+		sock_err = errno;
+	}
+	if (revents & POLLERR) {
+		(void)getsockopt(tp->probe.fd, SOL_SOCKET, SO_ERROR, &sock_err,
+				 &len);
+	}
+
+	/* ETIMEDOUT when keepalives went unanswered, ECONNRESET on an RST
+	 * from the NAT or from the server for an unknown mapping.
+	 */
+	LOG_INF("Connection lost after %d s, error: %d",
+		(int)((k_uptime_get() - tp->sent_ms) / S_TO_MS_MULT),
+		sock_err);
+	nat_event_emit(NAT_EVENT_PROBE_TIMEOUT, tp->type, tp->interval,
+		       sock_err);
+
+	nat_sched_deadline_clear(&sched, &tp->probe);
+	probe_outcome(tp, 0);
+}
+
+/* Handles a reply received while waiting for one */
+static void probe_reply(struct test_probe *tp,
+			const struct nat_json_reply *reply, int len,
+			s64_t recv_ms)
+{
+	enum reply_match match;
+	int result;
+
+	/* Error replies are matched too, a stale one must not end the test */
+	match = match_reply(tp, reply);
+	if (match != REPLY_MATCHED) {
+		/* Keep waiting for the reply to the current probe */
+		probe_discard_reply(tp, reply, match);
+		return;
+	}
+
+	tp->matched_seq = tp->seq;
+
+	if (reply->error) {
+		nat_event_emit(NAT_EVENT_PROBE_ERROR, tp->type, tp->interval,
+			       len);
+		result = -1;
+	} else {
+		nat_event_emit(NAT_EVENT_PROBE_REPLY, tp->type, tp->interval,
+			       len);
+
+		if (reply->has_timestamps) {
+			probe_latency_split(tp, reply, recv_ms);
+		}
+
+		if (tp->type == TEST_UDP_REBIND &&
+		    tp->phase == PROBE_PHASE_SEARCH) {
+			nat_sched_deadline_clear(&sched, &tp->probe);
+			rebind_reply(tp, reply);
+			return;
+		}
+
+		/* Second signal besides the missing reply */
+		(void)probe_mapping_update(tp, reply);
+		result = 1;
+	}
+
+	nat_sched_deadline_clear(&sched, &tp->probe);
+	probe_outcome(tp, result);
+}
+
+/* Passes a reply to the probe in flight through the impairment emulator.
+ * Returns true if the reply was consumed.
+ */
+static bool probe_impair_reply(struct test_probe *tp,
+			       const struct nat_json_reply *reply, int len,
+			       s64_t recv_ms)
+{
+	int slot = tp - test_probes;
+	s64_t release_ms;
+
+	/* Error replies are impaired like any other, unmatched ones are
+	 * left to probe_reply to discard.
+	 */
+	if (match_reply(tp, reply) != REPLY_MATCHED) {
+		return false;
+	}
+
+	switch (nat_impair_reply(slot, reply, len, recv_ms,
+				 tp->reply_deadline_ms)) {
+	case NAT_IMPAIR_DROP:
+		return true;
+	case NAT_IMPAIR_HOLD:
+		release_ms = nat_impair_release_ms(slot);
+		nat_sched_deadline_set(
+			&sched, &tp->probe,
+			MIN(release_ms, MIN(recv_ms + WAIT_LOG_THRESHOLD_MS,
+					    tp->reply_deadline_ms)));
+		return true;
+	case NAT_IMPAIR_DISCARD:
+		probe_discard_reply(tp, reply, REPLY_DUPLICATE);
+		return true;
+	case NAT_IMPAIR_DUPLICATE:
+		probe_reply(tp, reply, len, recv_ms);
+		/* The copy takes the path of a second datagram */
+		if (tp->state == PROBE_STATE_WAIT_REPLY) {
+			probe_reply(tp, reply, len, recv_ms);
+		} else {
+			LOG_WRN("Unexpected data on idle socket discarded");
+		}
+		return true;
+	default:
+		return false;
+	}
+}
+
+static void probe_on_readable(struct nat_probe *probe, short revents)
+{
+	struct test_probe *tp = CONTAINER_OF(probe, struct test_probe, probe);
+	struct nat_json_reply reply;
+	ssize_t ret_len;
+	s64_t recv_ms;
+
+	if (tp->state == PROBE_STATE_WAIT_KEEPALIVE) {
+		keepalive_on_readable(tp, revents);
+		return;
+	}
+
+	if ((revents & POLLIN) != POLLIN) {
+		LOG_ERR("Socket error, revents: 0x%x", revents);
+		goto failed;
+	}
+
+	ret_len = recv(probe->fd, recv_buf, sizeof(recv_buf) - 1, 0);
+	recv_ms = k_uptime_get();
+	if (ret_len <= 0) {
+		/* Closed by the peer or failed */
+		goto failed;
+	}
+
+	if (tp->state != PROBE_STATE_WAIT_REPLY) {
+		LOG_WRN("Unexpected data on idle socket discarded");
+		return;
+	}
+
+	recv_buf[ret_len] = 0;
+
+	LOG_HEXDUMP_DBG(recv_buf, ret_len, "Response");
+
+	nat_json_reply_parse(recv_buf, &reply);
+
+	if (probe_impair_reply(tp, &reply, ret_len, recv_ms)) {
+		return;
+	}
+
+	probe_reply(tp, &reply, ret_len, recv_ms);
+	return;
+
+failed:
+	if (tp->state != PROBE_STATE_WAIT_REPLY) {
+		probe_reconnect(tp);
+		return;
+	}
+
+	nat_sched_deadline_clear(&sched, probe);
+	probe_outcome(tp, -ENOTCONN);
+}
+
+static void probe_on_deadline(struct nat_probe *probe)
+{
+	struct test_probe *tp = CONTAINER_OF(probe, struct test_probe, probe);
+	struct nat_impair_held held;
+	s64_t now = k_uptime_get();
+	int err;
+
+	switch (tp->state) {
+	case PROBE_STATE_WAIT_LTE:
+		/* Wait for LTE link to be established */
+		if (!is_lte_connected()) {
+			nat_sched_deadline_set(&sched, probe,
+					       now + WAIT_TIME_S * S_TO_MS_MULT);
+			return;
+		}
+
+		err = setup_connection(&probe->fd, tp->type, tp->port, NULL);
+		if (err < 0) {
+			probe->fd = -1;
+			probe_finish(tp);
+			return;
+		}
+
+		if (tp->type == TEST_TCP_KEEPALIVE) {
+			keepalive_start(tp);
+		} else {
+			probe_send(tp);
+		}
+		break;
+	case PROBE_STATE_WAIT_KEEPALIVE:
+		LOG_INF("Connection alive after %d s",
+			(int)((now - tp->sent_ms) / S_TO_MS_MULT));
+		nat_event_emit(NAT_EVENT_PROBE_REPLY, tp->type, tp->interval, 0);
+		probe_outcome(tp, 1);
+		break;
+	case PROBE_STATE_IDLE:
+		probe_send(tp);
+		break;
+	case PROBE_STATE_WAIT_REPLY:
+		if (nat_impair_release(tp - test_probes, now, &held)) {
+			probe_reply(tp, &held.reply, held.len, now);
+			break;
+		}
+
+		if (now < tp->reply_deadline_ms) {
+			nat_event_emit(NAT_EVENT_PROBE_WAITING, tp->type,
+				       tp->interval,
+				       (int)((now - tp->sent_ms) /
+					     S_TO_MS_MULT));
+			nat_sched_deadline_set(
+				&sched, probe,
+				MIN(nat_impair_release_ms(tp - test_probes),
+				    MIN(now + WAIT_LOG_THRESHOLD_MS,
+					tp->reply_deadline_ms)));
+			return;
+		}
+
+		LOG_INF("No response from server");
+		nat_event_emit(NAT_EVENT_PROBE_TIMEOUT, tp->type, tp->interval,
+			       (int)((now - tp->sent_ms) / S_TO_MS_MULT));
+		if (tp->type == TEST_UDP_REBIND) {
+			rebind_timeout(tp);
+			break;
+		}
+		probe_outcome(tp, 0);
+		break;
+	default:
+		break;
+	}
+}
+
+static const struct nat_probe_ops test_probe_ops = {
+	.on_readable = probe_on_readable,
+	.on_deadline = probe_on_deadline,
+};
+
+static int test_probe_add(struct test_probe *tp, enum test_type type)
+{
+	int err;
+
+	memset(tp, 0, sizeof(*tp));
+	tp->type = type;
+	tp->phase = PROBE_PHASE_SEARCH;
+	tp->nonce = sys_rand32_get();
+	tp->start_ms = k_uptime_get();
+	init_values(&tp->timeout_data, type, &tp->port);
+
+	err = nat_sched_add(&sched, &tp->probe, &test_probe_ops);
+	if (err) {
+		return err;
+	}
+
+	/* Connect and send the first probe right away */
+	tp->state = PROBE_STATE_WAIT_LTE;
+	nat_sched_deadline_set(&sched, &tp->probe, k_uptime_get());
+
+	return 0;
+}
+
+static void nat_test_run(const enum test_type *types, size_t count,
+			 atomic_t *state)
+{
+	int err;
+
+	err = wait_for_lte(state);
+	if (err < 0) {
+		return;
+	}
+
+	err = fetch_network_params(&modem_params);
+	if (err) {
+		LOG_ERR("Unable to obtain modem parameters: %d", err);
+		return;
+	}
+
+	nat_sched_init(&sched);
+	nat_progress_test_start();
+	nat_energy_clear();
+	nat_impair_test_start();
+
+	for (size_t i = 0; i < count; i++) {
+		err = test_probe_add(&test_probes[i], types[i]);
+		if (err) {
+			LOG_ERR("Unable to add probe: %d", err);
+			break;
+		}
+	}
+
+	err = nat_sched_run(&sched, state, WAIT_TIME_S * S_TO_MS_MULT);
+	if (err < 0) {
+		/* Aborted, release the sockets of unfinished probes */
+		for (size_t i = 0; i < count; i++) {
+			if (test_probes[i].probe.fd >= 0) {
+				(void)close(test_probes[i].probe.fd);
+				test_probes[i].probe.fd = -1;
+			}
+		}
+	}
+
+	nat_impair_test_end();
+	nat_progress_test_end();
+}
+
+static void nat_test_run_both(struct test_thread_data *thread_data)
+{
+	static const enum test_type types[] = { TEST_UDP, TEST_TCP };
+
+	if (IS_ENABLED(CONFIG_NAT_TEST_CONCURRENT_PROBES)) {
+		nat_test_run(types, ARRAY_SIZE(types), &thread_data->state);
+		return;
+	}
+
+	nat_test_run(&types[0], 1, &thread_data->state);
+
+	if (atomic_get(&thread_data->state) != ABORT) {
+		nat_test_run(&types[1], 1, &thread_data->state);
+	}
+}
+
+#if defined(CONFIG_NAT_TEST_RESULTS)
+/* Returns the number of results acknowledged, or a negative error code */
+static int results_upload_batch(int fd, u32_t *pending, u32_t next)
+{
+	int err;
+	int len;
+	size_t count = 0;
+	u32_t last;
+	ssize_t ret_len;
+	struct nat_result results[RESULTS_BATCH_SIZE];
+	struct pollfd fds = {
+		.fd = fd,
+		.events = POLLIN,
+	};
+
+	for (; *pending < next && count < ARRAY_SIZE(results); (*pending)++) {
+		/* Results overwritten before their upload are skipped */
+		if (nat_results_read(*pending, &results[count]) == 0) {
+			count++;
+		}
+	}
+
+	if (count == 0) {
+		return 0;
+	}
+
+	len = nat_json_results_encode(results, count,
+				      modem_params.device.imei.value_string,
+				      send_buf, sizeof(send_buf));
+	nat_json_arena_reset();
+	if (len < 0) {
+		LOG_ERR("Failed to encode results: %d", len);
+		return len;
+	}
+
+	err = send(fd, send_buf, len + 1, 0);
+	if (err < 0) {
+		LOG_ERR("Failed to send results, errno: %d", errno);
+		return -ENOTCONN;
+	}
+
+	err = poll(&fds, 1, TIMEOUT_TOL_S * S_TO_MS_MULT);
+	if (err <= 0 || (fds.revents & POLLIN) != POLLIN) {
+		LOG_WRN("Results not acknowledged");
+		return -ETIMEDOUT;
+	}
+
+	ret_len = recv(fd, recv_buf, sizeof(recv_buf) - 1, 0);
+	if (ret_len <= 0) {
+		return -ENOTCONN;
+	}
+	recv_buf[ret_len] = 0;
+
+	err = nat_json_results_ack_parse(recv_buf, &last);
+	nat_json_arena_reset();
+	if (err) {
+		LOG_WRN("Invalid results acknowledgement");
+		return err;
+	}
+
+	err = nat_results_uploaded(last);
+	if (err) {
+		return err;
+	}
+
+	return count;
+}
+
+/* Uploads all pending results in as few messages as possible. Called right
+ * after a test, while the radio is most likely still connected.
+ */
+static void results_upload(void)
+{
+	int err;
+	int fd;
+	int uploaded = 0;
+	u32_t first;
+	u32_t next;
+	u32_t pending;
+
+	nat_results_range(&first, &next, &pending);
+	if (pending >= next) {
+		return;
+	}
+
+	if (!is_lte_connected()) {
+		LOG_INF("Result upload postponed, LTE not connected");
+		return;
+	}
+
+	err = setup_connection(&fd, TEST_UDP, UDP_PORT, NULL);
+	if (err < 0) {
+		return;
+	}
+
+	while (pending < next) {
+		err = results_upload_batch(fd, &pending, next);
+		if (err < 0) {
+			break;
+		}
+		uploaded += err;
+	}
+
+	(void)close(fd);
+
+	LOG_INF("%d results uploaded", uploaded);
+}
+
+int nat_test_results_upload(void)
+{
+	if (atomic_get(&test_thread.thread_data.state) != IDLE) {
+		return -1;
+	}
+
+	k_sem_give(&test_thread.thread_data.sem);
+
+	return 0;
+}
+#endif /* CONFIG_NAT_TEST_RESULTS */
+
+int nat_test_start(enum test_type type)
+{
+	int err;
+
+	switch (atomic_get(&test_thread.thread_data.state)) {
+	case RUNNING:
+	case ABORT:
+		return -EBUSY;
+	case IDLE:
+	default:
+		break;
+	}
+
+	if (type == TEST_TCP_KEEPALIVE &&
+	    !IS_ENABLED(CONFIG_NAT_TEST_TCP_KEEPALIVE)) {
+		LOG_ERR("TCP keepalive test not enabled");
+		return -ENOTSUP;
+	}
+
+	err = lte_lc_psm_req(false);
+	if (err < 0) {
+		LOG_ERR("Failed to disable PSM: %d", err);
+		return err;
+	}
+
+	err = lte_lc_edrx_req(false);
+	if (err < 0) {
+		LOG_ERR("Failed to disable eDRX: %d", err);
+		return err;
+	}
+
+	atomic_set(&test_thread.thread_data.type, type);
+	atomic_set(&test_thread.thread_data.start_pending, true);
+	k_sem_give(&test_thread.thread_data.sem);
+
+	return 0;
+}
+
+int nat_test_initial_timeout_set(enum test_type type, int timeout)
+{
+	if (timeout <= 0) {
+		return -EINVAL;
+	}
+
+	if (type == TEST_UDP) {
+		udp_initial_timeout = timeout;
+	} else if (type == TEST_TCP) {
+		tcp_initial_timeout = timeout;
+	} else {
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+int nat_test_timeout_multiplier_set(enum test_type type, float multiplier)
+{
+	if (multiplier <= 1) {
+		return -EINVAL;
+	}
+
+	if (type == TEST_UDP) {
+		udp_timeout_multiplier = multiplier;
+	} else if (type == TEST_TCP) {
+		tcp_timeout_multiplier = multiplier;
+	} else {
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+int nat_test_verify_cycles_set(int cycles)
+{
+	if (cycles <= 0) {
+		return -EINVAL;
+	}
+
+	keepalive_verify_cycles = cycles;
+
+	return 0;
+}
+
+int nat_test_verify_fractions_set(const int *fractions, size_t count)
+{
+	if (count == 0 || count > KEEPALIVE_VERIFY_MAX_FRACTIONS) {
+		return -EINVAL;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		if (fractions[i] <= 0 || fractions[i] > 100) {
+			return -EINVAL;
+		}
+	}
+
+	for (size_t i = 0; i < KEEPALIVE_VERIFY_MAX_FRACTIONS; i++) {
+		keepalive_verify_fractions[i] = i < count ? fractions[i] : 0;
+	}
+
+	return 0;
+}
+
+int nat_test_stop(void)
+{
+	switch (atomic_get(&test_thread.thread_data.state)) {
+	case RUNNING:
+		atomic_set(&test_thread.thread_data.state, ABORT);
+	case ABORT:
+		/* Give test thread enough time to detect abort request */
+		for (int i = 0; i < WAIT_TIME_S * 2; i++) {
+			if (atomic_get(&test_thread.thread_data.state) ==
+			    IDLE) {
+				return 0;
+			}
+			k_sleep(K_SECONDS(1));
+		}
+		return -1;
+	case IDLE:
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+static void nat_test_run_requested(struct test_thread_data *thread_data)
+{
+	atomic_set(&thread_data->state, RUNNING);
+
+	LOG_INF("Test started");
+	nat_event_emit(NAT_EVENT_TEST_STARTED, atomic_get(&thread_data->type),
+		       0, 0);
+	switch (atomic_get(&thread_data->type)) {
+	case TEST_UDP:
+	case TEST_TCP:
+	case TEST_UDP_REBIND:
+	case TEST_TCP_KEEPALIVE: {
+		enum test_type type = atomic_get(&thread_data->type);
+
+		nat_test_run(&type, 1, &thread_data->state);
+		break;
+	}
+	case TEST_UDP_AND_TCP:
+		nat_test_run_both(thread_data);
+		break;
+	default:
+		LOG_ERR("Thread with invalid type started");
+		break;
+	}
+	atomic_set(&thread_data->state, IDLE);
+	LOG_INF("Test idle");
+	nat_event_emit(NAT_EVENT_TEST_STOPPED, atomic_get(&thread_data->type),
+		       0, 0);
+}
+
+static void nat_test_thread_entry_point(void *param, void *unused,
+					void *unused2)
+{
+	int err;
+	struct test_thread_data *thread_data = (struct test_thread_data *)param;
+
+	err = modem_info_params_init(&modem_params);
+	if (err) {
+		LOG_ERR("Modem info params could not be initialised: %d", err);
+	}
+
+	prefetch_identity(&modem_params);
+
+	atomic_set(&thread_data->state, IDLE);
+
+	while (true) {
+		k_sem_take(&thread_data->sem, K_FOREVER);
+
+		if (atomic_cas(&thread_data->start_pending, true, false)) {
+			nat_test_run_requested(thread_data);
+		}
+
+#if defined(CONFIG_NAT_TEST_RESULTS)
+		results_upload();
+#endif
+	}
+}
+
+static void prepare_and_start_thread(struct test_thread *thread)
+{
+	k_sem_init(&thread->thread_data.sem, 0, 1);
+	thread->stack_area = nat_test_thread_stack_area;
+	atomic_set(&thread->thread_data.state, UNINITIALIZED);
+
+	thread->tid =
+		k_thread_create(&thread->thread, thread->stack_area,
+				THREAD_STACK_SIZE, nat_test_thread_entry_point,
+				(void *)&thread->thread_data, NULL, NULL,
+				THREAD_PRIORITY, 0, K_NO_WAIT);
+	k_thread_name_set(thread->tid, "nat_test");
+}
+
+void nat_test_init(void)
 {
 	udp_initial_timeout = DEFAULT_UDP_INITIAL_TIMEOUT;
 	tcp_initial_timeout = DEFAULT_TCP_INITIAL_TIMEOUT;
 	udp_timeout_multiplier = DEFAULT_UDP_TIMEOUT_MULTIPLIER;
 	tcp_timeout_multiplier = DEFAULT_TCP_TIMEOUT_MULTIPLIER;
+	keepalive_verify_enabled = IS_ENABLED(CONFIG_NAT_TEST_KEEPALIVE_VERIFY);
+	keepalive_verify_cycles = DEFAULT_KEEPALIVE_VERIFY_CYCLES;
+
+	for (int i = 0; i < ARRAY_SIZE(default_keepalive_verify_fractions); i++) {
+		keepalive_verify_fractions[i] =
+			default_keepalive_verify_fractions[i];
+	}
 
 	prepare_and_start_thread(&test_thread);
 }
@@ -13,8 +13,15 @@
 #define BUF_SIZE 512
 #define THREAD_PRIORITY 5
 #define S_TO_MS_MULT 1000
+#define KEEPALIVE_VERIFY_MAX_FRACTIONS 4
 
-enum test_type { TEST_UDP = 0, TEST_TCP = 1, TEST_UDP_AND_TCP = 2 };
+enum test_type {
+	TEST_UDP = 0,
+	TEST_TCP = 1,
+	TEST_UDP_AND_TCP = 2,
+	TEST_UDP_REBIND = 3,
+	TEST_TCP_KEEPALIVE = 4
+};
 
 enum test_state { UNINITIALIZED, IDLE, RUNNING, ABORT };
 
@@ -24,12 +31,28 @@ extern volatile int udp_initial_timeout;
 extern volatile int tcp_initial_timeout;
 extern volatile float udp_timeout_multiplier;
 extern volatile float tcp_timeout_multiplier;
+extern volatile bool keepalive_verify_enabled;
+extern volatile int keepalive_verify_cycles;
+extern volatile int keepalive_verify_fractions[KEEPALIVE_VERIFY_MAX_FRACTIONS];
 
 /**
  * @brief Function to get current test state
  */
 int get_test_state(void);
 
+/**
+ * @brief Function to get the name of a test type, as used by the shell
+ */
+const char *nat_test_type_name(enum test_type type);
+
+/**
+ * @brief Function to check whether keep-alive verification follows a result
+ *
+ * @param type Test type
+ * @param timeout Found timeout in seconds
+ */
+bool nat_test_verify_follows(enum test_type type, int timeout);
+
 /**
  * @brief Function to get network mode
  */
@@ -47,6 +70,27 @@ int set_network_mode(int mode);
  */
 int get_network_status(void);
 
+/**
+ * @brief Function to check whether the device is registered to a network
+ */
+bool is_lte_connected(void);
+
+/**
+ * @brief Function to wait for network registration
+ *
+ * @param timeout Maximum time to wait
+ *
+ * @return 0 if registered, -EAGAIN if the timeout expired first. The caller
+ *	   should check is_lte_connected() again, since the link may have been
+ *	   lost in the meantime.
+ */
+int lte_connected_wait(k_timeout_t timeout);
+
+/**
+ * @brief Function to get accumulated time spent in RRC connected mode
+ */
+s64_t get_rrc_connected_time_ms(void);
+
 /**
  * @brief Function to stop running test
  */
@@ -55,10 +99,64 @@ int nat_test_stop(void);
 /**
  * @brief Function to start test
  *
+ * Disables PSM and eDRX before the test is started.
+ *
  * @param type Test type
+ *
+ * @return 0 on success, -EBUSY if another test is active, -ENOTSUP if the
+ *	   test type is not enabled in the build, otherwise
+ *	   a negative error code from disabling PSM or eDRX.
  */
 int nat_test_start(enum test_type type);
 
+/**
+ * @brief Function to set the initial timeout of a test
+ *
+ * @param type TEST_UDP or TEST_TCP
+ * @param timeout Initial timeout in seconds, must be > 0
+ *
+ * @return 0 on success, -EINVAL if a parameter is invalid.
+ */
+int nat_test_initial_timeout_set(enum test_type type, int timeout);
+
+/**
+ * @brief Function to set the timeout multiplier of a test
+ *
+ * @param type TEST_UDP or TEST_TCP
+ * @param multiplier Timeout multiplier, must be > 1
+ *
+ * @return 0 on success, -EINVAL if a parameter is invalid.
+ */
+int nat_test_timeout_multiplier_set(enum test_type type, float multiplier);
+
+/**
+ * @brief Function to set the keep-alive verification cycles per interval
+ *
+ * @param cycles Cycle count, must be > 0
+ *
+ * @return 0 on success, -EINVAL if the count is invalid.
+ */
+int nat_test_verify_cycles_set(int cycles);
+
+/**
+ * @brief Function to set the keep-alive verification intervals
+ *
+ * @param fractions Fractions of the timeout in percent, each in range 1-100
+ * @param count Number of fractions, at most KEEPALIVE_VERIFY_MAX_FRACTIONS
+ *
+ * @return 0 on success, -EINVAL if a fraction or the count is invalid.
+ */
+int nat_test_verify_fractions_set(const int *fractions, size_t count);
+
+/**
+ * @brief Function to upload pending results
+ *
+ * The upload runs on the test thread.
+ *
+ * @return 0 if requested, -1 if a test is running.
+ */
+int nat_test_results_upload(void);
+
 /**
  * @brief Function for initializing the NAT-test client.
  */